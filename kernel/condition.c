@@ -4,21 +4,149 @@
  *  (C) 2021  Ziyang Guo
  */
 
+/*
+ * 等待队列以双向链表的形式串起线程池槽位
+ * 带超时的等待通过时钟事件实现，超时后线程被移出队列并唤醒
+ * 超时时间的单位均为微秒，0 表示一直等待
+ */
+
 #include "types.h"
 #include "def.h"
+#include "consts.h"
+#include "riscv.h"
 #include "condition.h"
-#include "queue.h"
 #include "thread.h"
+#include "timer.h"
+
+static void
+enqueue(Condvar *self, ThreadInfo *ti)
+{
+    ti->waitingOn = self;
+    ti->waitNext = 0;
+    ti->waitPrev = self->tail;
+    if(self->tail) {
+        self->tail->waitNext = ti;
+    } else {
+        self->head = ti;
+    }
+    self->tail = ti;
+}
+
+static void
+dequeue(Condvar *self, ThreadInfo *ti)
+{
+    if(ti->waitPrev) {
+        ti->waitPrev->waitNext = ti->waitNext;
+    } else {
+        self->head = ti->waitNext;
+    }
+    if(ti->waitNext) {
+        ti->waitNext->waitPrev = ti->waitPrev;
+    } else {
+        self->tail = ti->waitPrev;
+    }
+    ti->waitPrev = 0;
+    ti->waitNext = 0;
+    ti->waitingOn = 0;
+}
 
 /*
- * 将当前线程加入到等待队列中
- * 并主动让出 CPU 使用权
+ * 等待超时，由时钟中断调用，将线程移出等待队列并唤醒
+ * 其他 hart 可能同时通知该线程，需要在持有条件变量的锁后再次确认线程仍在等待
  */
+static void
+waitTimeout(usize arg)
+{
+    ThreadInfo *ti = (ThreadInfo *)arg;
+    Condvar *self = ti->waitingOn;
+    if(self) {
+        usize flags = acquireSpinlockIrqsave(&self->lock);
+        if(ti->waitingOn == self) {
+            dequeue(self, ti);
+            ti->waitTimedOut = 1;
+            wakeupCPU(ti->tid);
+        }
+        releaseSpinlockIrqrestore(&self->lock, flags);
+    }
+}
+
+/*
+ * 将当前线程加入到等待队列中，并主动让出 CPU 使用权
+ * deadline 为超时的时刻，0 表示一直等待
+ * pred 不为空时，加入队列后在锁内再检查一次 pred(arg)，成立则直接返回
+ * 其他 hart 上的通知者必须先获取锁才能看到队列，因此不会错过加入队列之后的通知
+ * 加入队列之后、让出之前到达的唤醒由线程池的 wakePending 记录
+ * 被通知或条件成立返回 1，超时或被其他原因唤醒返回 0
+ */
+static int
+waitUntil(Condvar *self, usize deadline, int (* pred)(void *), void *arg)
+{
+    usize flags = disable_and_store();
+    ThreadInfo *ti = getCurrentThreadInfo();
+    ti->waitTimedOut = 0;
+    acquireSpinlock(&self->lock);
+    enqueue(self, ti);
+    if(pred && pred(arg)) {
+        dequeue(self, ti);
+        releaseSpinlock(&self->lock);
+        restore_sstatus(flags);
+        return 1;
+    }
+    releaseSpinlock(&self->lock);
+    if(deadline) {
+        addTimer(&ti->waitTimer, deadline, waitTimeout, (usize)ti);
+    }
+    yieldCPU();
+    if(deadline) {
+        cancelTimer(&ti->waitTimer);
+    }
+    /* 被其他原因唤醒（例如遗留的 wakePending）时线程仍在队列中，需要自己移出 */
+    acquireSpinlock(&self->lock);
+    int notified = ti->waitingOn != self && !ti->waitTimedOut;
+    if(ti->waitingOn == self) {
+        dequeue(self, ti);
+    }
+    releaseSpinlock(&self->lock);
+    restore_sstatus(flags);
+    return notified;
+}
+
 void
 waitCondition(Condvar *self)
 {
-    pushBack(&self->waitQueue, getCurrentTid());
-    yieldCPU();
+    waitUntil(self, 0, 0, 0);
+}
+
+/* 最多等待 timeout 微秒，被通知返回 1，超时或被其他原因唤醒返回 0 */
+int
+waitConditionTimeout(Condvar *self, usize timeout)
+{
+    if(timeout == 0) {
+        return 0;
+    }
+    return waitUntil(self, r_time() + US_TO_TIME(timeout), 0, 0);
+}
+
+/*
+ * 等待直到 pred(arg) 成立，每次被唤醒后都会重新检查条件
+ * 加入等待队列后在条件变量的锁内再次检查，即使通知者在其他 hart 上也不会丢失通知
+ * pred 中不能获取该条件变量的锁
+ * 条件成立返回 1，超时返回 0
+ */
+int
+waitPredicate(Condvar *self, int (* pred)(void *), void *arg, usize timeout)
+{
+    usize flags = disable_and_store();
+    usize deadline = timeout ? r_time() + US_TO_TIME(timeout) : 0;
+    int ok;
+    while(!(ok = pred(arg))) {
+        if(deadline && r_time() >= deadline) {
+            break;
+        }
+        waitUntil(self, deadline, pred, arg);
+    }
+    restore_sstatus(flags);
+    return ok;
 }
 
 /*
@@ -28,8 +156,24 @@ waitCondition(Condvar *self)
 void
 notifyCondition(Condvar *self)
 {
-    if(!isEmpty(&self->waitQueue)) {
-        int tid = (int)popFront(&self->waitQueue);
-        wakeupCPU(tid);
+    usize flags = acquireSpinlockIrqsave(&self->lock);
+    ThreadInfo *ti = self->head;
+    if(ti) {
+        dequeue(self, ti);
+        wakeupCPU(ti->tid);
+    }
+    releaseSpinlockIrqrestore(&self->lock, flags);
+}
+
+/* 唤醒等待队列中的所有线程 */
+void
+notifyAll(Condvar *self)
+{
+    usize flags = acquireSpinlockIrqsave(&self->lock);
+    while(self->head) {
+        ThreadInfo *ti = self->head;
+        dequeue(self, ti);
+        wakeupCPU(ti->tid);
     }
-}
\ No newline at end of file
+    releaseSpinlockIrqrestore(&self->lock, flags);
+}
@@ -2,17 +2,25 @@
 #define _CONDITION_H
 
 #include "types.h"
-#include "queue.h"
+#include "spinlock.h"
+
+struct threadInfo;
 
 /* 
  * 条件变量
  * 内部为等待该条件满足的等待线程队列
+ * 队列节点直接嵌入在线程池槽位中，等待和唤醒不需要分配内存
  */
 typedef struct {
-    Queue waitQueue;
+    struct threadInfo *head;
+    struct threadInfo *tail;
+    Spinlock lock;      /* 保护等待队列，零初始化即可使用 */
 } Condvar;
 
 void waitCondition(Condvar *self);
+int waitConditionTimeout(Condvar *self, usize timeout);
+int waitPredicate(Condvar *self, int (* pred)(void *), void *arg, usize timeout);
 void notifyCondition(Condvar *self);
+void notifyAll(Condvar *self);
 
-#endif
\ No newline at end of file
+#endif
@@ -11,8 +11,8 @@ extern void bss_end();                          /* .bbs 段结束虚拟地址 */
 extern void kernel_end();                       /* 内核所在内存空间结束的虚拟地址 */
 
 /* 动态内存中定义堆的相关常量 */
-#define KERNEL_HEAP_SIZE    0x800000            /* 堆空间大小 */
-#define MIN_BLOCK_SIZE      0x40                /* 最小分配的内存块大小 */
+#define KERNEL_HEAP_SIZE    0x2000000           /* 堆空间大小 */
+#define MIN_BLOCK_SIZE      0x100               /* 最小分配的内存块大小 */
 #define HEAP_BLOCK_NUM      0x20000             /* 管理的总块数 */
 #define BUDDY_NODE_NUM      0x3ffff             /* 二叉树节点个数 */
 
@@ -26,10 +26,23 @@ extern void kernel_end();                       /* 内核所在内存空间结
 #define KERNEL_PAGE_OFFSET  0xffffffff00000     /* 内核页面线性映射偏移 */
 #define PDE_MASK            0x003ffffffffffC00  /* 该掩码用于从页表项中获取物理页号 */
 
-#define KERNEL_STACK_SIZE   0x80000             /* 内核栈大小 */
+#define KERNEL_STACK_SIZE   0x8000              /* 内核栈大小，栈没有保护页，需要留出嵌套中断的余量 */
 #define USER_STACK_SIZE     0x80000             /* 用户栈大小 */
 #define USER_STACK_OFFSET   0xffffffff00000000  /* 用户栈起始虚拟地址 */
+#define MAX_USER_STACK      64                  /* 每个进程最多同时存在的用户栈数，受 stackSlots 的位数限制 */
 
-#define MAX_THREAD          0x40                /* 线程池最大线程数 */
+#define TIMEBASE_FREQ       10000000            /* time 寄存器的计数频率 */
+#define US_TO_TIME(us)      ((us) * (TIMEBASE_FREQ / 1000000))  /* 微秒转换为 time 计数 */
+
+#define THREAD_CHUNK_SHIFT  6                   /* 线程池每次扩展 2^6 个槽位 */
+#define THREAD_CHUNK_SIZE   (1 << THREAD_CHUNK_SHIFT)
+
+#ifndef NCPU
+#define NCPU                1                   /* 最多支持的 hart 数，hartid 必须小于该值 */
+#endif
+
+#ifndef LOCK_STAT
+#define LOCK_STAT           1                   /* 是否统计锁的竞争情况 */
+#endif
 
 #endif
\ No newline at end of file
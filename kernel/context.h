@@ -14,8 +14,25 @@ typedef struct
 /* 线程切换前后的线程上下文 */
 typedef struct {
     usize ra;               /* ra 寄存器，保存线程当前的运行位置 */
-    usize satp;             /* satp 寄存器，保存线程使用的三级页表基址 */
     usize s[12];            /* 被调用者保存的 12 个通用寄存器 */
+    usize reserved;         /* 保持栈 16 字节对齐 */
 } ThreadContext;
 
+/* 用户线程的浮点寄存器上下文，第一次使用浮点指令时才分配 */
+typedef struct {
+    usize f[32];            /* 32 个浮点寄存器 */
+    usize fcsr;             /* 浮点控制状态寄存器 */
+    int lastCpu;            /* 上一次加载到哪个 hart 的寄存器中，-1 表示没有 */
+} FpContext;
+
+/* 用户线程的向量寄存器上下文，第一次使用向量指令时才分配 */
+typedef struct {
+    usize vstart;
+    usize vl;
+    usize vtype;
+    usize vcsr;
+    int lastCpu;            /* 上一次加载到哪个 hart 的寄存器中，-1 表示没有 */
+    uint8 v[];              /* 32 个向量寄存器，每个 vlenb 字节 */
+} VecContext;
+
 #endif
\ No newline at end of file
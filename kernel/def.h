@@ -5,9 +5,17 @@
 
 /* sbi.c */
 void consolePutchar(usize c);
-usize consoleGetchar();
+void consoleWrite(char *buf, usize len);
 void shutdown() __attribute__((noreturn));
 void setTimer(usize time);
+void sendIpi(usize hartMask);
+void remoteSfenceVma(usize hartMask, usize start, usize size);
+int startHart(usize hartid, usize startAddr, usize opaque);
+
+/* uart.c */
+void uartPutc(char c);
+void uartWrite(char *buf, usize len);
+void uartFlush();
 
 /* printf.c */
 void printf(char *, ...);
@@ -15,14 +23,28 @@ void panic(char*) __attribute__((noreturn));
 
 /* heap.c */
 void *kalloc(int size);
+void *tryKalloc(int size);
 void kfree(void *ptr);
 
 /* memory.c */
 usize allocFrame();
+usize tryAllocFrame();
 void deallocFrame(usize ppn);
 
 /* processor.c */
 void exitFromCPU(usize code);
+void preemptDisable();
+void preemptEnable();
+void preemptPoint();
+
+/* futex.c */
+int futexWait(uint32 *uaddr, uint32 expected, usize timeout);
+int futexWake(uint32 *uaddr, int n);
+
+/* ipi.c */
+void postIpi(int hart, int type);
+void handleIpi();
+void shootdownTlb(usize cpuMask, usize start, usize size);
 
 /* string.c */
 int strlen(char *str);
@@ -7,6 +7,7 @@
  /*
   * entry.asm 是程序的入口，被放置在物理内存 0x80200000 处
   * 主要用于设置内核启动栈并跳转到 main 函数
+  * 其他 hart 由启动 hart 通过 SBI 唤醒后从 _secondaryStart 开始执行
   */
 
     .section .text.entry
@@ -28,11 +29,36 @@ _start:
     lui sp, %hi(bootstacktop)
     addi sp, sp, %lo(bootstacktop)
 
+    # OpenSBI 将 hartid 放在 a0 中，内核中 tp 始终保存当前 hart 的编号
+    mv tp, a0
+
     # 跳转到 main
     lui t0, %hi(main)
     addi t0, t0, %lo(main)
     jr t0
 
+    # 其他 hart 的入口，以物理地址开始执行
+    # a0 为 hartid，a1 为启动 hart 为其分配的栈顶虚拟地址
+    .globl _secondaryStart
+_secondaryStart:
+    # 与启动 hart 相同，先使用启动页表进入高地址空间
+    lui t0, %hi(bootpagetable)
+    li t1, 0xffffffff00000000
+    sub t0, t0, t1
+    srli t0, t0, 12
+    li t1, (8 << 60)
+    or t0, t0, t1
+    csrw satp, t0
+    sfence.vma
+
+    mv sp, a1
+    mv tp, a0
+
+    # 跳转到 secondaryMain
+    lui t0, %hi(secondaryMain)
+    addi t0, t0, %lo(secondaryMain)
+    jr t0
+
     .section .stack
     .align 12
 
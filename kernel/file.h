@@ -6,6 +6,7 @@
 
 #define FD_NONE     0
 #define FD_INODE    1
+#define FD_CONSOLE  2   /* 标准输入输出，读写终端 */
 
 typedef struct
 {
@@ -0,0 +1,330 @@
+/*
+ *  kernel/fpu.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * fpu.c 负责用户线程浮点和向量寄存器的惰性保存与恢复
+ *
+ * 新的用户线程 sstatus 中 FS、VS 均为 Off，第一次使用时触发非法指令异常，此时才分配上下文
+ * 线程切换出去时，只有 U-Mode 上下文中的 FS/VS 为 Dirty 才保存寄存器，保存后置为 Clean
+ * 每个 hart 记录寄存器中是哪个线程的状态，线程回到同一 hart 且期间没有被其他线程覆盖时不需要恢复
+ * 从不使用浮点和向量的线程没有任何额外开销
+ *
+ * 内核以不含 F、D、V 扩展的 -march 编译，编译器不会生成浮点和向量指令
+ * 从 U-Mode 进入中断时 interrupt.asm 关闭 FS、VS，返回时恢复保存的 sstatus
+ * 因此内核中 FS、VS 保持为 Off，只有本文件在保存和恢复寄存器时临时开启
+ */
+
+#include "types.h"
+#include "def.h"
+#include "riscv.h"
+#include "context.h"
+#include "thread.h"
+#include "mapping.h"
+
+static int hasFp;       /* 是否支持浮点扩展 */
+static usize vlenb;     /* 每个向量寄存器的字节数，0 表示不支持向量扩展 */
+
+/* 每个 hart 的寄存器中当前是哪个上下文的状态 */
+static FpContext *fpOwner[NCPU];
+static VecContext *vecOwner[NCPU];
+
+/* 非法指令所属的单元 */
+#define UNIT_NONE   0
+#define UNIT_FP     1
+#define UNIT_VEC    2
+
+/*
+ * 探测浮点和向量扩展
+ * 不支持的扩展对应的 FS、VS 字段恒为 0
+ * 每个 hart 都需要调用，探测后关闭内核中的浮点和向量单元
+ */
+void
+initFpu()
+{
+    w_sstatus(r_sstatus() | FS_INITIAL | VS_INITIAL);
+    usize sstatus = r_sstatus();
+    hasFp = (sstatus & SSTATUS_FS) != 0;
+    if(sstatus & SSTATUS_VS) {
+        asm volatile(".option push\n.option arch, +v\ncsrr %0, vlenb\n.option pop" : "=r" (vlenb));
+    }
+    w_sstatus(r_sstatus() & ~(SSTATUS_FS | SSTATUS_VS));
+}
+
+static void
+saveFp(FpContext *fp)
+{
+    w_sstatus(r_sstatus() | FS_CLEAN);
+    asm volatile(
+        ".option push\n"
+        ".option arch, +d\n"
+        ".irp n, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+        "fsd f\\n, \\n*8(%0)\n"
+        ".endr\n"
+        "frcsr t0\n"
+        "sd t0, 32*8(%0)\n"
+        ".option pop\n"
+        : : "r" (fp) : "t0", "memory");
+    w_sstatus(r_sstatus() & ~SSTATUS_FS);
+}
+
+static void
+restoreFp(FpContext *fp)
+{
+    w_sstatus(r_sstatus() | FS_CLEAN);
+    asm volatile(
+        ".option push\n"
+        ".option arch, +d\n"
+        ".irp n, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+        "fld f\\n, \\n*8(%0)\n"
+        ".endr\n"
+        "ld t0, 32*8(%0)\n"
+        "fscsr t0\n"
+        ".option pop\n"
+        : : "r" (fp) : "t0", "memory");
+    w_sstatus(r_sstatus() & ~SSTATUS_FS);
+}
+
+/* 整寄存器读写与 vl、vtype 无关，每次处理 8 个寄存器 */
+static void
+saveVec(VecContext *vec)
+{
+    w_sstatus(r_sstatus() | VS_CLEAN);
+    asm volatile(
+        ".option push\n"
+        ".option arch, +v\n"
+        "csrr %0, vstart\n"
+        "csrr %1, vl\n"
+        "csrr %2, vtype\n"
+        "csrr %3, vcsr\n"
+        "csrw vstart, zero\n"
+        "vs8r.v v0, (%4)\n"
+        "add t0, %4, %5\n"
+        "vs8r.v v8, (t0)\n"
+        "add t0, t0, %5\n"
+        "vs8r.v v16, (t0)\n"
+        "add t0, t0, %5\n"
+        "vs8r.v v24, (t0)\n"
+        ".option pop\n"
+        : "=&r" (vec->vstart), "=&r" (vec->vl), "=&r" (vec->vtype), "=&r" (vec->vcsr)
+        : "r" (vec->v), "r" (vlenb * 8)
+        : "t0", "memory");
+    w_sstatus(r_sstatus() & ~SSTATUS_VS);
+}
+
+static void
+restoreVec(VecContext *vec)
+{
+    w_sstatus(r_sstatus() | VS_CLEAN);
+    asm volatile(
+        ".option push\n"
+        ".option arch, +v\n"
+        "vl8re8.v v0, (%0)\n"
+        "add t0, %0, %1\n"
+        "vl8re8.v v8, (t0)\n"
+        "add t0, t0, %1\n"
+        "vl8re8.v v16, (t0)\n"
+        "add t0, t0, %1\n"
+        "vl8re8.v v24, (t0)\n"
+        "vsetvl zero, %2, %3\n"
+        "csrw vstart, %4\n"
+        "csrw vcsr, %5\n"
+        ".option pop\n"
+        : : "r" (vec->v), "r" (vlenb * 8), "r" (vec->vl), "r" (vec->vtype),
+            "r" (vec->vstart), "r" (vec->vcsr)
+        : "t0", "memory");
+    w_sstatus(r_sstatus() & ~SSTATUS_VS);
+}
+
+/* 将线程的浮点寄存器加载到当前 hart，寄存器中已经是该线程的状态时跳过 */
+static void
+loadFp(FpContext *fp)
+{
+    int cpu = cpuid();
+    if(fpOwner[cpu] != fp || fp->lastCpu != cpu) {
+        restoreFp(fp);
+        fpOwner[cpu] = fp;
+        fp->lastCpu = cpu;
+    }
+}
+
+static void
+loadVec(VecContext *vec)
+{
+    int cpu = cpuid();
+    if(vecOwner[cpu] != vec || vec->lastCpu != cpu) {
+        restoreVec(vec);
+        vecOwner[cpu] = vec;
+        vec->lastCpu = cpu;
+    }
+}
+
+/*
+ * 线程切换时调用，调用时关闭了异步中断
+ * 保存 self 被修改过的寄存器，并将 target 的寄存器加载到当前 hart
+ */
+void
+switchFpu(Thread *self, Thread *target)
+{
+    if(self->fp || self->vec) {
+        InterruptContext *ic = userContext(self);
+        if(self->fp && (ic->sstatus & SSTATUS_FS) == FS_DIRTY) {
+            saveFp(self->fp);
+            ic->sstatus = (ic->sstatus & ~SSTATUS_FS) | FS_CLEAN;
+        }
+        if(self->vec && (ic->sstatus & SSTATUS_VS) == VS_DIRTY) {
+            saveVec(self->vec);
+            ic->sstatus = (ic->sstatus & ~SSTATUS_VS) | VS_CLEAN;
+        }
+    }
+    if(target->fp) {
+        loadFp(target->fp);
+    }
+    if(target->vec) {
+        loadVec(target->vec);
+    }
+}
+
+/* 根据指令编码判断其所属的单元 */
+static int
+instructionUnit(usize inst)
+{
+    if((inst & 3) != 3) {
+        /* 压缩指令中只有 c.fld、c.fsd、c.fldsp、c.fsdsp 使用浮点寄存器 */
+        usize op = inst & 3, funct3 = (inst >> 13) & 7;
+        if((op == 0 || op == 2) && (funct3 == 1 || funct3 == 5)) {
+            return UNIT_FP;
+        }
+        return UNIT_NONE;
+    }
+    usize opcode = inst & 0x7f;
+    usize funct3 = (inst >> 12) & 7;
+    usize csr = (inst >> 20) & 0xfff;
+    switch(opcode) {
+    case 0x07:  /* LOAD-FP */
+    case 0x27:  /* STORE-FP */
+        /* 宽度为 16、32、64、128 位时为浮点访存，否则为向量访存 */
+        return (funct3 >= 1 && funct3 <= 4) ? UNIT_FP : UNIT_VEC;
+    case 0x43:  /* FMADD */
+    case 0x47:  /* FMSUB */
+    case 0x4b:  /* FNMSUB */
+    case 0x4f:  /* FNMADD */
+    case 0x53:  /* OP-FP */
+        return UNIT_FP;
+    case 0x57:  /* OP-V */
+        return UNIT_VEC;
+    case 0x73:  /* SYSTEM，访问浮点或向量 CSR */
+        if(funct3 == 0) {
+            return UNIT_NONE;
+        }
+        if(csr >= 0x001 && csr <= 0x003) {
+            return UNIT_FP;
+        }
+        if((csr >= 0x008 && csr <= 0x00a) || csr == 0x00f || (csr >= 0xc20 && csr <= 0xc22)) {
+            return UNIT_VEC;
+        }
+        return UNIT_NONE;
+    default:
+        return UNIT_NONE;
+    }
+}
+
+/* 为当前线程开启浮点单元，寄存器初始为 0 */
+static int
+enableFp(InterruptContext *context, Thread *thread)
+{
+    if(!hasFp || (context->sstatus & SSTATUS_FS) != FS_OFF) {
+        return 0;
+    }
+    if(!thread->fp) {
+        thread->fp = kalloc(sizeof(FpContext));
+        thread->fp->lastCpu = -1;
+    }
+    loadFp(thread->fp);
+    context->sstatus |= FS_CLEAN;
+    return 1;
+}
+
+/* 为当前线程开启向量单元，vtype 初始为非法值，与复位状态一致 */
+static int
+enableVec(InterruptContext *context, Thread *thread)
+{
+    if(!vlenb || (context->sstatus & SSTATUS_VS) != VS_OFF) {
+        return 0;
+    }
+    if(!thread->vec) {
+        thread->vec = kalloc(sizeof(VecContext) + 32 * vlenb);
+        thread->vec->vtype = 1UL << 63;
+        thread->vec->lastCpu = -1;
+    }
+    loadVec(thread->vec);
+    context->sstatus |= VS_CLEAN;
+    return 1;
+}
+
+/*
+ * 处理 U-Mode 的非法指令异常
+ * 如果是第一次使用浮点或向量指令，开启对应单元并返回 1，之后重新执行该指令
+ * 否则是真正的非法指令，返回 0
+ */
+int
+handleFpuTrap(InterruptContext *context, usize stval)
+{
+    if(context->sstatus & SSTATUS_SPP) {
+        return 0;
+    }
+    Thread *thread = getCurrentThread();
+    usize inst = stval;
+    if(inst == 0) {
+        /*
+         * 部分实现不在 stval 中提供指令编码，需要从用户内存取指
+         * 通过页表检查指令所在页是用户可执行的，不直接访问用户给出的地址
+         * 两个 16 位的指令片段可能位于不同的页，分别转换
+         */
+        Mapping m = {thread->process->satp & ((1L << 44) - 1)};
+        usize pa = translateUserVa(m, context->sepc, EXECUTABLE);
+        if(pa == 0) {
+            return 0;
+        }
+        inst = *(uint16 *)accessVaViaPa(pa);
+        if((inst & 3) == 3) {
+            pa = translateUserVa(m, context->sepc + 2, EXECUTABLE);
+            if(pa == 0) {
+                return 0;
+            }
+            inst |= (usize)*(uint16 *)accessVaViaPa(pa) << 16;
+        }
+    }
+    switch(instructionUnit(inst)) {
+    case UNIT_FP:
+        return enableFp(context, thread);
+    case UNIT_VEC:
+        /* 向量浮点指令同时需要浮点单元 */
+        return enableVec(context, thread) || enableFp(context, thread);
+    default:
+        return 0;
+    }
+}
+
+/* 线程退出后回收浮点和向量上下文 */
+void
+releaseFpu(Thread *thread)
+{
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        FpContext *fp = thread->fp;
+        VecContext *vec = thread->vec;
+        __atomic_compare_exchange_n(&fpOwner[i], &fp, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        __atomic_compare_exchange_n(&vecOwner[i], &vec, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    if(thread->fp) {
+        kfree(thread->fp);
+        thread->fp = 0;
+    }
+    if(thread->vec) {
+        kfree(thread->vec);
+        thread->vec = 0;
+    }
+}
@@ -70,6 +70,7 @@ lookup(Inode *node, char *filename)
                 Inode *candidate = (Inode *)getBlockAddr(node->direct[i].block);
                 return lookup(candidate, filename);
             }
+            preemptPoint();
         }
         return 0;
     } else {
@@ -79,6 +80,7 @@ lookup(Inode *node, char *filename)
                 Inode *candidate = (Inode *)getBlockAddr(node->direct[i].block);
                 return lookup(candidate, filename);
             }
+            preemptPoint();
         }
         InodeItem *indirect = (InodeItem *)getBlockAddr(node->indirect);
         for(i = 12; i < blockNum; i ++) {
@@ -87,6 +89,7 @@ lookup(Inode *node, char *filename)
                 Inode *candidate = (Inode *)getBlockAddr(node->direct[i].block);
                 return lookup(candidate, filename);
             }
+            preemptPoint();
         }
         return 0;
     }
@@ -116,6 +119,7 @@ readall(Inode *node, char *buf) {
            copyByteToBuf(src, buf, copySize);
            buf += copySize;
            l -= copySize;
+           preemptPoint();
        }
     } else {
         int i;
@@ -125,6 +129,7 @@ readall(Inode *node, char *buf) {
             copyByteToBuf(src, buf, copySize);
             buf += copySize;
             l -= copySize;
+            preemptPoint();
         }
         InodeItem *indirect = (InodeItem *)getBlockAddr(node->indirect);
         for(i = 0; i < b-12; i ++) {
@@ -133,6 +138,7 @@ readall(Inode *node, char *buf) {
             copyByteToBuf(src, buf, copySize);
             buf += copySize;
             l -= copySize;
+            preemptPoint();
         }
     }
 }
@@ -149,15 +155,18 @@ ls(Inode *node)
         int i;
         for(i = 0; i < node->blocks; i ++) {
             printf("%s ", node->direct[i].filename);
+            preemptPoint();
         }
     } else {
         int i;
         for(i = 0; i < 12; i ++) {
             printf("%s ", node->direct[i].filename);
+            preemptPoint();
         }
         InodeItem *indirect = (InodeItem *)getBlockAddr(node->indirect);
         for(i = 0; i < node->blocks-12; i ++) {
             printf("%s ", indirect[i].filename);
+            preemptPoint();
         }
     }
     printf("\n");
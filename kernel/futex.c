@@ -0,0 +1,179 @@
+/*
+ *  kernel/futex.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * futex.c 为用户态的锁和条件变量提供等待和唤醒机制
+ * 用户程序只在竞争发生时才陷入内核
+ *
+ * 等待者以用户地址对应的物理地址为键，散列到不同的等待桶中
+ * 每个等待者的节点分配在它自己的内核栈上，等待和唤醒都不需要分配内存
+ */
+
+#include "types.h"
+#include "def.h"
+#include "consts.h"
+#include "riscv.h"
+#include "thread.h"
+#include "mapping.h"
+#include "timer.h"
+#include "spinlock.h"
+
+#define FUTEX_BUCKETS   64      /* 等待桶个数，必须为 2 的幂 */
+
+/* 等待者的状态 */
+#define FUTEX_WAITING   0
+#define FUTEX_WOKEN     1
+#define FUTEX_TIMEOUT   2
+
+typedef struct futexWaiter {
+    usize key;                  /* 等待地址的物理地址 */
+    int tid;                    /* 等待的线程 */
+    int state;
+    struct futexWaiter *prev;
+    struct futexWaiter *next;
+} FutexWaiter;
+
+/* 每个桶都是一个带哨兵节点的双向循环链表 */
+static FutexWaiter buckets[FUTEX_BUCKETS];
+
+/* 保护所有等待桶，不同 hart 上的等待和唤醒可能同时操作同一个桶 */
+static Spinlock futexLock;
+
+void
+initFutex()
+{
+    initSpinlock(&futexLock, "futex");
+    int i;
+    for(i = 0; i < FUTEX_BUCKETS; i ++) {
+        buckets[i].prev = &buckets[i];
+        buckets[i].next = &buckets[i];
+    }
+}
+
+static FutexWaiter *
+hashBucket(usize key)
+{
+    return &buckets[(((key >> 2) * 0x9E3779B97F4A7C15UL) >> 58) & (FUTEX_BUCKETS - 1)];
+}
+
+static void
+unlinkWaiter(FutexWaiter *w)
+{
+    w->prev->next = w->next;
+    w->next->prev = w->prev;
+}
+
+/*
+ * 获取用户地址对应的物理地址作为键
+ * 同一物理页可能被映射到不同的虚拟地址，物理地址才能唯一确定一个 futex
+ * 地址必须是用户可读的，否则返回 0，不能用 futex 探测内核内存
+ */
+static usize
+futexKey(uint32 *uaddr)
+{
+    if((usize)uaddr & 3) {
+        return 0;
+    }
+    Mapping m = {getCurrentThread()->process->satp & ((1L << 44) - 1)};
+    return translateUserVa(m, (usize)uaddr, READABLE);
+}
+
+/* 等待超时，由时钟中断调用 */
+static void
+futexTimeout(usize arg)
+{
+    FutexWaiter *w = (FutexWaiter *)arg;
+    usize flags = acquireSpinlockIrqsave(&futexLock);
+    if(w->state == FUTEX_WAITING) {
+        unlinkWaiter(w);
+        w->state = FUTEX_TIMEOUT;
+        wakeupCPU(w->tid);
+    }
+    releaseSpinlockIrqrestore(&futexLock, flags);
+}
+
+/*
+ * 如果 *uaddr 仍等于 expected，就休眠直到被 futexWake 唤醒
+ * timeout 为等待的最长微秒数，0 表示一直等待
+ * 被唤醒返回 0，值不相等或地址非法返回 -1，超时返回 -2
+ */
+int
+futexWait(uint32 *uaddr, uint32 expected, usize timeout)
+{
+    usize flags = disable_and_store();
+    usize key = futexKey(uaddr);
+    if(key == 0) {
+        restore_sstatus(flags);
+        return -1;
+    }
+    /* 检查值和加入等待桶需要在锁内完成，否则可能错过其他 hart 上的唤醒 */
+    acquireSpinlock(&futexLock);
+    if(*uaddr != expected) {
+        releaseSpinlock(&futexLock);
+        restore_sstatus(flags);
+        return -1;
+    }
+    FutexWaiter w;
+    w.key = key;
+    w.tid = getCurrentTid();
+    w.state = FUTEX_WAITING;
+    FutexWaiter *head = hashBucket(key);
+    w.prev = head->prev;
+    w.next = head;
+    head->prev->next = &w;
+    head->prev = &w;
+    releaseSpinlock(&futexLock);
+
+    Timer t;
+    t.pending = 0;
+    if(timeout) {
+        addTimer(&t, r_time() + US_TO_TIME(timeout), futexTimeout, (usize)&w);
+    }
+    /*
+     * 节点在栈上，只有被 futexWake 或 futexTimeout 移出等待桶后才能返回
+     * 其他原因导致的唤醒（例如遗留的 wakePending）继续休眠
+     */
+    acquireSpinlock(&futexLock);
+    while(w.state == FUTEX_WAITING) {
+        releaseSpinlock(&futexLock);
+        yieldCPU();
+        acquireSpinlock(&futexLock);
+    }
+    releaseSpinlock(&futexLock);
+    if(timeout) {
+        cancelTimer(&t);
+    }
+    restore_sstatus(flags);
+    return w.state == FUTEX_TIMEOUT ? -2 : 0;
+}
+
+/* 唤醒最多 n 个在 uaddr 上等待的线程，返回唤醒的线程数 */
+int
+futexWake(uint32 *uaddr, int n)
+{
+    usize flags = disable_and_store();
+    usize key = futexKey(uaddr);
+    if(key == 0) {
+        restore_sstatus(flags);
+        return -1;
+    }
+    acquireSpinlock(&futexLock);
+    FutexWaiter *head = hashBucket(key), *w = head->next;
+    int woken = 0;
+    while(w != head && woken < n) {
+        FutexWaiter *next = w->next;
+        if(w->key == key) {
+            unlinkWaiter(w);
+            w->state = FUTEX_WOKEN;
+            wakeupCPU(w->tid);
+            woken ++;
+        }
+        w = next;
+    }
+    releaseSpinlock(&futexLock);
+    restore_sstatus(flags);
+    return woken;
+}
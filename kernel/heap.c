@@ -14,6 +14,7 @@
 #include "types.h"
 #include "def.h"
 #include "consts.h"
+#include "spinlock.h"
 
 #define LEFT_LEAF(index) ((index) * 2 + 1)
 #define RIGHT_LEAF(index) ((index) * 2 + 2)
@@ -22,9 +23,12 @@
 #define IS_POWER_OF_2(x) (!((x)&((x)-1)))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-/* 用于分配的堆空间，存放在 .bss 段，8 MBytes */
+/* 用于分配的堆空间，存放在 .bss 段，32 MBytes，大部分用于线程的内核栈 */
 static uint8 HEAP[KERNEL_HEAP_SIZE];
 
+/* 保护 buddyTree，在 kalloc 和 kfree 中获取 */
+static TicketLock heapLock;
+
 void buddyInit(int size);
 int buddyAlloc(int size);
 void buddyFree(int offset);
@@ -32,6 +36,7 @@ void buddyFree(int offset);
 void
 initHeap()
 {
+    initTicketLock(&heapLock, "heap");
     buddyInit(HEAP_BLOCK_NUM);
 }
 
@@ -51,14 +56,16 @@ fixSize(int size)
     return n + 1;
 }
 
-/* 在堆上分配内存 */
+/* 在堆上分配内存，空间不足时返回 0 */
 void *
-kalloc(int size)
+tryKalloc(int size)
 {
     if(size <= 0) return 0;
     int n = (size - 1) / MIN_BLOCK_SIZE + 1;
+    usize flags = acquireTicketLockIrqsave(&heapLock);
     int block = buddyAlloc(n);
-    if(block == -1) panic("Malloc failed!\n");
+    releaseTicketLockIrqrestore(&heapLock, flags);
+    if(block == -1) return 0;
 
     /* 清零被分配的内存空间 */
     int totalBytes = fixSize(n) * MIN_BLOCK_SIZE;
@@ -71,6 +78,15 @@ kalloc(int size)
     return (void *)beginAddr;
 }
 
+/* 在堆上分配内存，空间不足时 panic */
+void *
+kalloc(int size)
+{
+    void *ptr = tryKalloc(size);
+    if(size > 0 && ptr == 0) panic("Malloc failed!\n");
+    return ptr;
+}
+
 /* 回收被分配出去的内存 */
 void
 kfree(void *ptr)
@@ -79,7 +95,9 @@ kfree(void *ptr)
     if((usize)ptr > (usize)HEAP + KERNEL_HEAP_SIZE - MIN_BLOCK_SIZE) return;
     /* 相对于堆空间起始地址的偏移 */
     usize offset = (usize)((usize)ptr - (usize)HEAP);
+    usize flags = acquireTicketLockIrqsave(&heapLock);
     buddyFree(offset / MIN_BLOCK_SIZE);
+    releaseTicketLockIrqrestore(&heapLock, flags);
 }
 
 /* 
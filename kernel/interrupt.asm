@@ -6,8 +6,19 @@
 
 /* 
  * interrupt.asm 是中断处理程序的入口
- * 由于 S-Mode 中断被设置为 Direct 模式，所有的中断发生时都会执行这个程序
+ * S-Mode 中断被设置为 Vectored 模式，异常跳转到 __vectors 处，再进入 __interrupt
+ * 软件中断、时钟中断和外部中断分别跳转到各自的入口
  * 主要过程是在中断发生时将当前程序的上下文保存在内核栈上，并在中断处理完成后恢复
+ *
+ * 异步中断的处理函数都是普通的 C 函数，s0-s11 由其自行保存，即使中途切换线程也由 switch.asm 保存
+ * 因此异步中断入口只保存调用者保存寄存器、sp、tp、sstatus 和 sepc，不经过 handleInterrupt 的分发
+ * 处理函数返回后调用 irqExit 处理软中断和调度请求
+ * 栈帧布局与完整的 Context 相同，未保存的位置内容无意义
+ *
+ * 来自 U-Mode 的系统调用走快速路径 __syscall：
+ * 用户态的系统调用封装已经声明 ra、t0-t6、a1-a7 会被破坏，s0-s11 由 C 函数自行保存
+ * 因此只需保存 sp、tp、sstatus 和 sepc，按 a7 查系统调用表后直接调用，返回时清零被破坏的寄存器
+ * 快速路径使用与完整路径相同的栈帧布局，sstatus 同样保存在第 32 个位置
  */
 
 .altmacro
@@ -15,6 +26,10 @@
 .set    REG_SIZE, 8
 # Context 大小为 34 字节
 .set    CONTEXT_SIZE, 34
+# 系统调用表的大小，与 syscall.c 中的 SYSCALL_COUNT 一致
+.set    SYSCALL_COUNT, 256
+# sstatus 中的 FS 和 VS 字段，进入内核时清零，返回时随保存的 sstatus 恢复
+.set    SSTATUS_FPU, 0x6600
 
 # 宏：保存寄存器到栈上
 .macro SAVE reg, offset
@@ -35,8 +50,70 @@
 .endm
 
 
+# 宏：异步中断入口，只保存调用者保存寄存器，然后直接调用 handler
+.macro INTERRUPT_ENTRY name, handler
+\name:
+    csrrw   sp, sscratch, sp
+    # 与 __interrupt 相同，sp = 0 说明从 S-Mode 进入中断
+    bnez    sp, 1f
+    csrr    sp, sscratch
+1:
+    addi    sp, sp, -34*REG_SIZE
+    SAVE    x1, 1
+    SAVE    x5, 5
+    SAVE    x6, 6
+    SAVE    x7, 7
+    .set    n, 10
+    .rept   8
+        SAVE_N  %n
+        .set    n, n + 1
+    .endr
+    .set    n, 28
+    .rept   4
+        SAVE_N  %n
+        .set    n, n + 1
+    .endr
+    csrrw   t0, sscratch, x0
+    csrr    t1, sstatus
+    csrr    t2, sepc
+    SAVE    t0, 2
+    SAVE    t1, 32
+    SAVE    t2, 33
+    li      t0, SSTATUS_FPU
+    csrc    sstatus, t0
+    # 从 U-Mode 进入时保存用户的 tp，并恢复当前 hart 的编号
+    andi    t0, t1, 1 << 8
+    bnez    t0, 2f
+    SAVE    tp, 4
+    LOAD    tp, 34
+2:
+    call    \handler
+    call    irqExit
+    j       __restore_partial
+.endm
+
+
     .section .text
-    .globl __interrupt
+    .globl __vectors
+    # 向量表的每一项必须是 4 字节的跳转指令，不能使用压缩指令
+    # 基址按 64 字节对齐，部分实现对向量表基址有更严格的要求
+    .balign 64
+.option push
+.option norvc
+# 向量表，异常和未单独处理的中断进入 __interrupt
+__vectors:
+    j       __interrupt         # 0 异常
+    j       __soft_entry        # 1 软件中断
+    j       __interrupt
+    j       __interrupt
+    j       __interrupt
+    j       __timer_entry       # 5 时钟中断
+    j       __interrupt
+    j       __interrupt
+    j       __interrupt
+    j       __external_entry    # 9 外部中断
+.option pop
+
     # 中断处理函数需要 4 字节对齐
     .balign 4
 # 全局中断处理，保存 Context 并跳转到 handleInterrupt() 处
@@ -52,9 +129,18 @@ __interrupt:
     bnez    sp, from_user
 from_kernel:
     csrr    sp, sscratch
-from_user:
     # 移动栈指针，留出 Context 的空间
     addi    sp, sp, -34*REG_SIZE
+    j       save_all
+from_user:
+    addi    sp, sp, -34*REG_SIZE
+    # 系统调用（scause = 8）走快速路径
+    SAVE    t0, 5
+    csrr    t0, scause
+    addi    t0, t0, -8
+    beqz    t0, __syscall
+    LOAD    t0, 5
+save_all:
     
     # 保存通用寄存器，其中 x0 固定为 0
     SAVE    x1, 1
@@ -77,6 +163,15 @@ from_user:
     SAVE    s0, 2
     SAVE    s1, 32
     SAVE    s2, 33
+    # 内核中关闭浮点和向量单元
+    li      s0, SSTATUS_FPU
+    csrc    sstatus, s0
+
+    # 从 U-Mode 进入时 tp 为用户的值，从内核栈顶预留的位置恢复当前 hart 的编号
+    andi    s0, s1, 1 << 8
+    bnez    s0, call_handler
+    LOAD    tp, 34
+call_handler:
 
     # 调用 handleInterrupt()
     # 将 Context 的地址(栈顶)和 scause、stval 作为参数传入
@@ -106,7 +201,13 @@ to_user:
     # 则此时 sscratch 指向用户栈顶
     # 令其指向内核栈顶地址
     csrw    sscratch, s0
+    # 在内核栈顶预留的位置记录当前 hart 的编号，下次从 U-Mode 进入中断时恢复
+    sd      tp, 0(s0)
+    j       restore_csr
 to_kernel:
+    # 线程可能已经换到其他 hart 上继续运行，保持 tp 为当前 hart 的编号
+    SAVE    tp, 4
+restore_csr:
     # 恢复 sstatus 和 sepc
     csrw    sstatus, s1
     csrw    sepc, s2
@@ -123,3 +224,111 @@ to_kernel:
     # 最后恢复 sp（这里最后恢复是为了上面可以正常使用 LOAD 宏）
     LOAD    x2, 2
     sret
+
+
+
+    .globl __syscall
+# 系统调用快速路径，此时 sp 已经指向内核栈上的 Context，t0 已保存
+__syscall:
+    # 保存用户栈，并将 sscratch 清零表示进入内核
+    csrrw   t0, sscratch, x0
+    SAVE    t0, 2
+    SAVE    tp, 4
+    csrr    t0, sstatus
+    SAVE    t0, 32
+    li      t1, SSTATUS_FPU
+    csrc    sstatus, t1
+    # 返回地址为 ecall 的下一条指令
+    csrr    t0, sepc
+    addi    t0, t0, 4
+    SAVE    t0, 33
+    # 恢复当前 hart 的编号
+    LOAD    tp, 34
+
+    # 按 a7 查表，未定义的系统调用交给 unknownSyscall
+    li      t0, SYSCALL_COUNT
+    bgeu    a7, t0, syscall_unknown
+    la      t0, syscallTable
+    slli    t1, a7, 3
+    add     t0, t0, t1
+    ld      t0, 0(t0)
+    beqz    t0, syscall_unknown
+
+    # 系统调用期间允许中断
+    csrsi   sstatus, 1 << 1
+    jalr    t0
+    csrci   sstatus, 1 << 1
+
+    # 恢复 sstatus 和 sepc，期间可能被浮点单元的惰性切换修改
+    LOAD    t0, 32
+    csrw    sstatus, t0
+    LOAD    t0, 33
+    csrw    sepc, t0
+    # 令 sscratch 指向内核栈顶，并记录当前 hart 的编号
+    addi    t0, sp, 34 * REG_SIZE
+    csrw    sscratch, t0
+    sd      tp, 0(t0)
+    LOAD    tp, 4
+
+    # 清零调用者保存寄存器，不向用户态泄露内核数据，a0 为返回值
+    li      ra, 0
+    li      t0, 0
+    li      t1, 0
+    li      t2, 0
+    li      t3, 0
+    li      t4, 0
+    li      t5, 0
+    li      t6, 0
+    li      a1, 0
+    li      a2, 0
+    li      a3, 0
+    li      a4, 0
+    li      a5, 0
+    li      a6, 0
+    li      a7, 0
+    LOAD    x2, 2
+    sret
+
+syscall_unknown:
+    mv      a0, a7
+    call    unknownSyscall
+
+
+
+# 各异步中断的入口
+INTERRUPT_ENTRY __soft_entry, handleIpi
+INTERRUPT_ENTRY __timer_entry, supervisorTimer
+INTERRUPT_ENTRY __external_entry, external
+
+    .globl __restore_partial
+# 从异步中断的处理函数返回，只恢复入口处保存的寄存器
+__restore_partial:
+    LOAD    t1, 32
+    LOAD    t2, 33
+    andi    t0, t1, 1 << 8
+    bnez    t0, 1f
+    # 返回 U-Mode，令 sscratch 指向内核栈顶并记录当前 hart 的编号
+    addi    t0, sp, 34 * REG_SIZE
+    csrw    sscratch, t0
+    sd      tp, 0(t0)
+    LOAD    tp, 4
+1:
+    # 返回 S-Mode 时 tp 保持为当前 hart 的编号
+    csrw    sstatus, t1
+    csrw    sepc, t2
+    LOAD    x1, 1
+    LOAD    x5, 5
+    LOAD    x6, 6
+    LOAD    x7, 7
+    .set    n, 10
+    .rept   8
+        LOAD_N  %n
+        .set    n, n + 1
+    .endr
+    .set    n, 28
+    .rept   4
+        LOAD_N  %n
+        .set    n, n + 1
+    .endr
+    LOAD    x2, 2
+    sret
@@ -10,71 +10,57 @@
 #include "riscv.h"
 #include "interrupt.h"
 #include "consts.h"
-#include "stdin.h"
+#include "thread.h"
+#include "plic.h"
+#include "softirq.h"
 
 asm(".include \"kernel/interrupt.asm\"");
 
-/*
- * OpenSBI默认会关闭所有的外部中断和串口设备中断（键盘中断），以防止初始化过程被打断
- * 这里需要手动打开
- * 写法来源：https://github.com/rcore-os/rCore/blob/3ac4d7a607dbe81167f5d6ad799bc91682ab9f7d/kernel/src/arch/riscv/board/virt/mod.rs
- */
+/* 每个 hart 都需要进行的中断初始化 */
 void
-initExternalInterrupt()
+initHartInterrupt()
 {
-    *(uint32 *)(0x0C002080 + KERNEL_MAP_OFFSET) = 0x400U;
-    *(uint32 *)(0x0C000028 + KERNEL_MAP_OFFSET) = 0x7U;
-    *(uint32 *)(0x0C201000 + KERNEL_MAP_OFFSET) = 0x0U;
-}
+    /* 
+     * 设置 stvec 寄存器
+     * 设置中断向量表和处理模式，各类异步中断跳转到各自的入口
+     */
+    extern void __vectors();
+    w_stvec((usize)__vectors | MODE_VECTOR);
 
-void
-initSerialInterrupt()
-{
-    *(uint8 *)(0x10000001 + KERNEL_MAP_OFFSET) = 0x01U;
-    *(uint8 *)(0x10000004 + KERNEL_MAP_OFFSET) = 0x0bU;
+    /* 开启软件中断，用于接收核间中断 */
+    w_sie(r_sie() | SIE_SSIE);
+
+    /* 初始化当前 hart 的 PLIC 上下文 */
+    initHartPlic();
 }
 
 void
 initInterrupt()
 {
-    /* 
-     * 设置 stvec 寄存器
-     * 设置中断处理函数和处理模式
-     */
-    extern void __interrupt();
-    w_stvec((usize)__interrupt | MODE_DIRECT);
+    initPlic();
+    initHartInterrupt();
 
-    /* 开启外部中断 */
+    /* 开启外部中断，目前设备中断只使能到启动 hart */
     w_sie(r_sie() | SIE_SEIE);
 
-    /* 打开 OpenSBI 的外部中断响应和串口设备响应 */
-    initExternalInterrupt();
-    initSerialInterrupt();
+    /* 注册软中断 */
+    extern void timerSoftirq();
+    openSoftirq(SOFTIRQ_TIMER, timerSoftirq);
+
+    /* 初始化串口，打开串口设备响应 */
+    extern void initUart(); initUart();
 
     printf("***** Init Interrupt *****\n");
 }
 
 /* 
  * 处理外部中断
- * 由于目前外部设备只打开了串口设备
- * 所以只需要处理键盘中断
+ * 由 PLIC 驱动分发给各设备注册的处理函数
  */
 void
 external()
 {
-    usize ret = consoleGetchar();
-    /* 
-     * 调用 SBI 接口获得输入的字符，可能出现错误
-     * 所有获取到的字符都被存入标准输入缓冲区
-     */
-    if(ret != -1) {
-        char ch = (char)ret;
-        if(ch == '\r') {
-            pushChar('\n');
-        } else {
-            pushChar(ch);
-        }
-    }
+    handlePlic();
 }
 
 /* 
@@ -89,32 +75,35 @@ breakpoint(InterruptContext *context)
     context->sepc += 2;
 }
 
-/* 
- * 处理来自 U-Mode 的系统调用
- * 返回值存储在 x10（a0）寄存器
+/*
+ * 时钟中断，主要用于调度
+ * 屏蔽时钟中断直到软中断中重新设置时钟，其余工作推迟到时钟软中断
  */
 void
-handleSyscall(InterruptContext *context)
+supervisorTimer()
 {
-    context->sepc += 4;
-    extern usize syscall(usize id, usize args[3], InterruptContext *context);
-    usize ret = syscall(
-        context->x[17],
-        (usize[]){context->x[10], context->x[11], context->x[12]},
-        context
-    );
-    context->x[10] = ret;
+    w_sie(r_sie() & ~SIE_STIE);
+    raiseSoftirq(SOFTIRQ_TIMER);
 }
 
 /*
- * 时钟中断，主要用于调度
- * 设置下一次时钟中断时间并通知调度器检查当前线程时间片
+ * 时钟软中断
+ * 触发到期的时钟事件，抢占时钟到期时通知调度器检查当前线程时间片
+ * 最后根据调度状态设置下一次时钟中断，并重新打开时钟中断
  */
 void
-supervisorTimer()
+timerSoftirq()
 {
-    extern void tick(); tick();
-    extern void tickCPU(); tickCPU();
+    extern int tick();
+    int expired = tick();
+    /* 调度器的时间片记录与核间中断中的唤醒共享，检查期间关闭中断 */
+    usize flags = disable_and_store();
+    if(expired) {
+        extern void tickCPU(); tickCPU();
+    }
+    extern void updateTimer(); updateTimer();
+    w_sie(r_sie() | SIE_STIE);
+    restore_sstatus(flags);
 }
 
 /* 
@@ -132,22 +121,38 @@ fault(InterruptContext *context, usize scause, usize stval)
     panic("");
 }
 
+/*
+ * 异常和未单独处理的中断的统一入口
+ * Vectored 模式下时钟、外部和软件中断由 interrupt.asm 中各自的入口直接处理，这里的分支只作为后备
+ */
 void
 handleInterrupt(InterruptContext *context, usize scause, usize stval)
 {
     switch (scause)
     {
+    case ILLEGAL_INSTRUCTION:
+    {
+        /* 第一次使用浮点或向量指令，开启对应单元后重新执行；探测 Sstc 引起的异常跳过该指令 */
+        extern int handleSstcProbe(InterruptContext *context);
+        if(!handleFpuTrap(context, stval) && !handleSstcProbe(context)) {
+            fault(context, scause, stval);
+        }
+        break;
+    }
     case BREAKPOINT:
         breakpoint(context);
         break;
-    case USER_ENV_CALL:
-        handleSyscall(context);
-        break;
     case SUPERVISOR_TIMER:
         supervisorTimer();
+        irqExit();
         break;
     case SUPERVISOR_EXTERNAL:
         external();
+        irqExit();
+        break;
+    case SUPERVISOR_SOFT:
+        handleIpi();
+        irqExit();
         break;
     default:
         fault(context, scause, stval);
@@ -0,0 +1,119 @@
+/*
+ *  kernel/ipi.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * ipi.c 实现了 hart 之间的通信
+ *
+ * 每个 hart 有一个邮箱，其他 hart 向邮箱投递请求后通过 SBI 发送核间中断
+ * 邮箱是无锁的：请求类型用原子或合并，待唤醒的线程用 CAS 压入单链表
+ * 目标 hart 处理之前的多个请求只会触发一次核间中断
+ *
+ * TLB shootdown 直接使用 SBI 的 RFENCE 扩展，只发送给运行过该地址空间的 hart
+ */
+
+#include "types.h"
+#include "def.h"
+#include "consts.h"
+#include "riscv.h"
+#include "thread.h"
+#include "ipi.h"
+
+typedef struct {
+    int pending;            /* 尚未处理的请求类型 */
+    ThreadInfo *wakeList;   /* 需要在该 hart 上唤醒的线程 */
+} Mailbox;
+
+static Mailbox mailboxes[NCPU];
+
+/* 单页刷新的页数上限，超过时直接刷新整个 TLB */
+#define SFENCE_PAGE_LIMIT   32
+
+/* 向 hart 投递一个请求，对方还有未处理的请求时不再重复发送核间中断 */
+void
+postIpi(int hart, int type)
+{
+    if(!__atomic_fetch_or(&mailboxes[hart].pending, type, __ATOMIC_ACQ_REL)) {
+        sendIpi(1UL << hart);
+    }
+}
+
+/*
+ * 请求 hart 唤醒线程 ti
+ * 线程已经在某个邮箱中时不再重复投递
+ */
+void
+ipiWakeup(int hart, ThreadInfo *ti)
+{
+    if(__atomic_exchange_n(&ti->ipiQueued, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    Mailbox *mb = &mailboxes[hart];
+    ThreadInfo *head = __atomic_load_n(&mb->wakeList, __ATOMIC_RELAXED);
+    do {
+        ti->ipiNext = head;
+    } while(!__atomic_compare_exchange_n(&mb->wakeList, &head, ti, 1,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    postIpi(hart, IPI_WAKEUP);
+}
+
+/* 处理核间中断，在中断处理中调用 */
+void
+handleIpi()
+{
+    /* 先清除中断等待位，之后投递的请求会再次触发中断 */
+    clear_ssip();
+    Mailbox *mb = &mailboxes[cpuid()];
+    int pending = __atomic_exchange_n(&mb->pending, 0, __ATOMIC_ACQ_REL);
+    if(pending & IPI_WAKEUP) {
+        ThreadInfo *list = __atomic_exchange_n(&mb->wakeList, 0, __ATOMIC_ACQUIRE);
+        /* 链表与投递顺序相反，反转后按投递顺序唤醒 */
+        ThreadInfo *ordered = 0;
+        while(list) {
+            ThreadInfo *next = list->ipiNext;
+            list->ipiNext = ordered;
+            ordered = list;
+            list = next;
+        }
+        while(ordered) {
+            ThreadInfo *next = ordered->ipiNext;
+            __atomic_store_n(&ordered->ipiQueued, 0, __ATOMIC_RELEASE);
+            receiveWakeup(ordered);
+            ordered = next;
+        }
+    }
+    if(pending & (IPI_WAKEUP | IPI_TIMER)) {
+        extern void updateTimer(); updateTimer();
+    }
+    /* IPI_RESCHED 只需要让 idle 从 wfi 中返回，由 idle 重新查找线程 */
+}
+
+/*
+ * 刷新 cpuMask 中所有 hart 上 [start, start + size) 的 TLB
+ * 本 hart 直接执行 sfence.vma，其他 hart 合并为一次 SBI 调用
+ * SBI 在所有目标 hart 完成刷新后才返回，之后可以安全地回收物理页
+ */
+void
+shootdownTlb(usize cpuMask, usize start, usize size)
+{
+    /* 刷新期间不能迁移到其他 hart */
+    usize flags = disable_and_store();
+    usize self = 1UL << cpuid();
+    if(cpuMask & self) {
+        if(size / PAGE_SIZE > SFENCE_PAGE_LIMIT) {
+            asm volatile("sfence.vma":::);
+        } else {
+            usize va;
+            for(va = start; va < start + size; va += PAGE_SIZE) {
+                asm volatile("sfence.vma %0" : : "r" (va));
+            }
+        }
+    }
+    usize others = cpuMask & ~self;
+    if(others) {
+        remoteSfenceVma(others, start, size);
+    }
+    restore_sstatus(flags);
+}
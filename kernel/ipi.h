@@ -0,0 +1,14 @@
+#ifndef _IPI_H
+#define _IPI_H
+
+#include "types.h"
+#include "thread.h"
+
+/* 核间中断请求类型，可以按位合并 */
+#define IPI_WAKEUP      (1 << 0)    /* 唤醒邮箱中的线程 */
+#define IPI_TIMER       (1 << 1)    /* 重新设置时钟中断 */
+#define IPI_RESCHED     (1 << 2)    /* 空闲的 hart 重新检查是否有线程可以运行 */
+
+void ipiWakeup(int hart, ThreadInfo *ti);
+
+#endif
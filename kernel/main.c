@@ -22,11 +22,31 @@ main()
 {
     printf("Initializing Moonix...\n");
     extern void initMemory();       initMemory();
+    extern void initStdin();        initStdin();
     extern void initInterrupt();    initInterrupt();
     extern void initFs();           initFs();
+    extern void initFutex();        initFutex();
+    extern void initFpu();          initFpu();
     extern void initThread();       initThread();
     extern void initTimer();        initTimer();
+    extern void startHarts();       startHarts();
     extern void runCPU();           runCPU();
     /* 不可能回到此处，因为启动线程的信息已经丢失 */
     while(1) {}
+}
+
+/*
+ * 其他 hart 由启动 hart 通过 SBI 启动后进入此处
+ * 共享的模块已经初始化完成，只需初始化每个 hart 自己的状态
+ */
+void
+secondaryMain()
+{
+    extern void initHartMemory();       initHartMemory();
+    extern void initHartInterrupt();    initHartInterrupt();
+    extern void initFpu();              initFpu();
+    extern void initHartThread();       initHartThread();
+    extern void initHartTimer();        initHartTimer();
+    extern void runCPU();               runCPU();
+    while(1) {}
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "def.h"
 #include "consts.h"
 #include "mapping.h"
+#include "plic.h"
 
 /* 根据虚拟页号得到其对应页表项在三级页表中的位置 */
 void
@@ -53,6 +54,116 @@ PageTableEntry
     return entry;
 }
 
+/*
+ * 查询虚拟地址在该映射下对应的物理地址
+ * 不会创建页表，地址未被映射时返回 0
+ */
+usize
+translateVa(Mapping self, usize va)
+{
+    PageTable *table = (PageTable *)accessVaViaPa(self.rootPpn << 12);
+    usize levels[3]; getVpnLevels(va / PAGE_SIZE, levels);
+    int i;
+    for(i = 0; i <= 2; i ++) {
+        PageTableEntry entry = table->entries[levels[i]];
+        if(!(entry & VALID)) {
+            return 0;
+        }
+        usize pa = (entry & PDE_MASK) << 2;
+        if(i == 2) {
+            return pa + (va & (PAGE_SIZE - 1));
+        }
+        table = (PageTable *)accessVaViaPa(pa);
+    }
+    return 0;
+}
+
+/*
+ * 查询用户虚拟地址在该映射下对应的物理地址
+ * 页表项必须同时具有 VALID、USER 和 flags 中的权限，否则返回 0
+ * 用于检查系统调用传入的地址，防止用户通过内核地址读写内核内存
+ */
+usize
+translateUserVa(Mapping self, usize va, usize flags)
+{
+    PageTable *table = (PageTable *)accessVaViaPa(self.rootPpn << 12);
+    usize levels[3]; getVpnLevels(va / PAGE_SIZE, levels);
+    int i;
+    for(i = 0; i <= 2; i ++) {
+        PageTableEntry entry = table->entries[levels[i]];
+        if(!(entry & VALID)) {
+            return 0;
+        }
+        usize pa = (entry & PDE_MASK) << 2;
+        if(i == 2) {
+            usize need = VALID | USER | flags;
+            if((entry & need) != need) {
+                return 0;
+            }
+            return pa + (va & (PAGE_SIZE - 1));
+        }
+        table = (PageTable *)accessVaViaPa(pa);
+    }
+    return 0;
+}
+
+/*
+ * 从用户地址 src 复制 len 字节到内核缓冲区 dst
+ * 逐页检查用户地址可读，通过物理地址的线性映射访问，不会触发缺页
+ * 成功返回 0，地址非法返回 -1
+ */
+int
+copyFromUser(Mapping self, char *dst, usize src, usize len)
+{
+    while(len > 0) {
+        usize pa = translateUserVa(self, src, READABLE);
+        if(pa == 0) {
+            return -1;
+        }
+        usize n = PAGE_SIZE - (src & (PAGE_SIZE - 1));
+        if(n > len) {
+            n = len;
+        }
+        char *from = (char *)accessVaViaPa(pa);
+        usize i;
+        for(i = 0; i < n; i ++) {
+            dst[i] = from[i];
+        }
+        dst += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * 从内核缓冲区 src 复制 len 字节到用户地址 dst
+ * 逐页检查用户地址可写，成功返回 0，地址非法返回 -1
+ */
+int
+copyToUser(Mapping self, usize dst, char *src, usize len)
+{
+    while(len > 0) {
+        usize pa = translateUserVa(self, dst, WRITABLE);
+        if(pa == 0) {
+            return -1;
+        }
+        usize n = PAGE_SIZE - (dst & (PAGE_SIZE - 1));
+        if(n > len) {
+            n = len;
+        }
+        char *to = (char *)accessVaViaPa(pa);
+        usize i;
+        for(i = 0; i < n; i ++) {
+            to[i] = src[i];
+        }
+        src += n;
+        dst += n;
+        len -= n;
+    }
+    return 0;
+}
+
 /*
  * 线性映射一个段
  * 段中的每一个虚拟地址都会按照固定偏移量线性映射到一个物理地址
@@ -75,9 +186,10 @@ mapLinearSegment(Mapping self, Segment segment)
 /* 
  * 映射一个未被分配物理内存的段
  * 在映射时会实时分配物理内存并填充页表项
+ * 物理内存耗尽时返回 -1，已经映射的部分由调用者通过 unmapFramedSegment 回收
  */
-void
-mapFramedSegment(Mapping m, Segment segment)
+int
+tryMapFramedSegment(Mapping m, Segment segment)
 {
     usize startVpn = segment.startVaddr / PAGE_SIZE;
     usize endVpn = (segment.endVaddr - 1) / PAGE_SIZE + 1;
@@ -87,7 +199,22 @@ mapFramedSegment(Mapping m, Segment segment)
         if(*entry != 0) {
             panic("Virtual address already mapped!\n");
         }
-        *entry = (allocFrame() >> 2) | segment.flags | VALID;
+        usize pAddr = tryAllocFrame();
+        if(pAddr == 0) {
+            return -1;
+        }
+        *entry = (pAddr >> 2) | segment.flags | VALID;
+        preemptPoint();
+    }
+    return 0;
+}
+
+/* 映射一个未被分配物理内存的段，物理内存耗尽时 panic */
+void
+mapFramedSegment(Mapping m, Segment segment)
+{
+    if(tryMapFramedSegment(m, segment) < 0) {
+        panic("Physical memory depleted!\n");
     }
 }
 
@@ -134,6 +261,32 @@ mapFramedAndCopy(Mapping m, Segment segment, char *data, usize length)
         s += PAGE_SIZE;
         if(l >= PAGE_SIZE) l -= PAGE_SIZE;
         else l = 0;
+        preemptPoint();
+    }
+}
+
+/*
+ * 取消映射一个段，并回收段中已分配的物理页
+ * cpuMask 为可能缓存了该映射的 hart，页表项失效后先刷新这些 hart 的 TLB
+ * 刷新完成后其他 hart 不会再访问这些物理页，此时才能回收
+ */
+void
+unmapFramedSegment(Mapping m, Segment segment, usize cpuMask)
+{
+    usize startVpn = segment.startVaddr / PAGE_SIZE;
+    usize endVpn = (segment.endVaddr - 1) / PAGE_SIZE + 1;
+    usize vpn;
+    for(vpn = startVpn; vpn < endVpn; vpn ++) {
+        PageTableEntry *entry = findEntry(m, vpn);
+        *entry &= ~VALID;
+    }
+    shootdownTlb(cpuMask, startVpn * PAGE_SIZE, (endVpn - startVpn) * PAGE_SIZE);
+    for(vpn = startVpn; vpn < endVpn; vpn ++) {
+        PageTableEntry *entry = findEntry(m, vpn);
+        if(*entry != 0) {
+            deallocFrame((*entry & PDE_MASK) << 2);
+            *entry = 0;
+        }
     }
 }
 
@@ -205,48 +358,46 @@ newKernelMapping()
 /* 
  * 由于启用外部中断和键盘中断需要修改一部分内存
  * 将这部分内存也线性映射到虚拟地址空间
+ * PLIC 中各 hart 的上下文分布在整个区域中，全部映射
  */
 void
 mapExtInterruptArea(Mapping m)
 {
     Segment s1 = {
-        (usize)0x0C000000 + KERNEL_MAP_OFFSET,
-        (usize)0x0C001000 + KERNEL_MAP_OFFSET,
+        (usize)PLIC_BASE + KERNEL_MAP_OFFSET,
+        (usize)PLIC_BASE + PLIC_SIZE + KERNEL_MAP_OFFSET,
         1L | READABLE | WRITABLE
     };
     mapLinearSegment(m, s1);
 
     Segment s2 = {
-        (usize)0x0C002000 + KERNEL_MAP_OFFSET,
-        (usize)0x0C003000 + KERNEL_MAP_OFFSET,
-        1L | READABLE | WRITABLE
-    };
-    mapLinearSegment(m, s2);
-
-    Segment s3 = {
-        (usize)0x0C201000 + KERNEL_MAP_OFFSET,
-        (usize)0x0C202000 + KERNEL_MAP_OFFSET,
-        1L | READABLE | WRITABLE
-    };
-    mapLinearSegment(m, s3);
-
-    Segment s4 = {
         (usize)0x10000000 + KERNEL_MAP_OFFSET,
         (usize)0x10001000 + KERNEL_MAP_OFFSET,
         1L | READABLE | WRITABLE
     };
-    mapLinearSegment(m, s4);
+    mapLinearSegment(m, s2);
 }
 
+/* 内核地址空间，其他 hart 启动时也切换到该映射 */
+static Mapping kernelMapping;
+
 /* 重映射内核 */
 void
 mapKernel()
 {
     Mapping m = newKernelMapping();
     mapExtInterruptArea(m);
+    kernelMapping = m;
     activateMapping(m);
 }
 
+/* 在当前 hart 上激活内核地址空间 */
+void
+activateKernelMapping()
+{
+    activateMapping(kernelMapping);
+}
+
 /* 获得线性映射后的虚拟地址 */
 usize
 accessVaViaPa(usize pa)
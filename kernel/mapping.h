@@ -42,10 +42,16 @@ typedef struct
 } Mapping;
 
 usize accessVaViaPa(usize pa);
+usize translateVa(Mapping self, usize va);
+usize translateUserVa(Mapping self, usize va, usize flags);
+int copyFromUser(Mapping self, char *dst, usize src, usize len);
+int copyToUser(Mapping self, usize dst, char *src, usize len);
 
 Mapping newKernelMapping();
 void mapLinearSegment(Mapping self, Segment segment);
 void mapFramedSegment(Mapping m, Segment segment);
+int tryMapFramedSegment(Mapping m, Segment segment);
 void mapFramedAndCopy(Mapping m, Segment segment, char *data, usize length);
+void unmapFramedSegment(Mapping m, Segment segment, usize cpuMask);
 
 #endif
\ No newline at end of file
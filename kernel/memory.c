@@ -9,6 +9,7 @@
 #include "memory.h"
 #include "consts.h"
 #include "riscv.h"
+#include "spinlock.h"
 
 /* 全局唯一的页帧分配器 */
 FrameAllocator frameAllocator;
@@ -27,12 +28,16 @@ initFrameAllocator(usize startPpn, usize endPpn)
 
 /*
  * 分配一个物理页
- * 返回物理页的起始地址
+ * 返回物理页的起始地址，物理内存耗尽时返回 0
  */
 usize
-allocFrame()
+tryAllocFrame()
 {
-    usize start = alloc() << 12;
+    usize ppn = alloc();
+    if(ppn == 0) {
+        return 0;
+    }
+    usize start = ppn << 12;
     int i;
     /*
      * 清空被分配的区域
@@ -45,6 +50,17 @@ allocFrame()
     return (usize)start;
 }
 
+/* 分配一个物理页，物理内存耗尽时 panic */
+usize
+allocFrame()
+{
+    usize start = tryAllocFrame();
+    if(start == 0) {
+        panic("Physical memory depleted!\n");
+    }
+    return start;
+}
+
 /*
  * 回收一个物理页
  * 参数为物理页的起始物理地址
@@ -82,6 +98,14 @@ initMemory()
     printf("***** Init Memory *****\n");
 }
 
+/* 其他 hart 的内存初始化，物理内存和内核映射都已由启动 hart 准备好 */
+void
+initHartMemory()
+{
+    w_sstatus(r_sstatus() | SSTATUS_SUM);
+    extern void activateKernelMapping(); activateKernelMapping();
+}
+
 
 /* 以下为分配算法的具体实现 */
 
@@ -94,11 +118,13 @@ struct
     usize firstSingle;                      /* 第一个单块节点的下标 */
     usize length;                           /* 分配区间长度 */
     usize startPpn;                         /* 分配的起始 ppn */
+    Spinlock lock;
 } sta;
 
 Allocator
 newAllocator(usize startPpn, usize endPpn)
 {
+    initSpinlock(&sta.lock, "frame");
     sta.startPpn = startPpn - 1;
     sta.length = endPpn - startPpn;
     sta.firstSingle = 1;
@@ -121,13 +147,15 @@ newAllocator(usize startPpn, usize endPpn)
 
 /*
  * 分配一个物理页
- * 返回物理页号
+ * 返回物理页号，没有空闲页时返回 0
  */
 usize
 alloc()
 {
+    usize flags = acquireSpinlockIrqsave(&sta.lock);
     if(sta.node[1] == 1) {
-        panic("Physical memory depleted!\n");
+        releaseSpinlockIrqrestore(&sta.lock, flags);
+        return 0;
     }
     usize p = 1;
     while(p < sta.firstSingle) {
@@ -144,6 +172,7 @@ alloc()
         sta.node[p] = sta.node[p << 1] & sta.node[(p << 1) | 1];
         p >>= 1;
     }
+    releaseSpinlockIrqrestore(&sta.lock, flags);
     return result;
 }
 
@@ -154,8 +183,10 @@ alloc()
 void
 dealloc(usize ppn)
 {
+    usize flags = acquireSpinlockIrqsave(&sta.lock);
     usize p = ppn - sta.startPpn + sta.firstSingle;
     if(sta.node[p] != 1) {
+        releaseSpinlockIrqrestore(&sta.lock, flags);
         printf("The page is free, no need to dealloc!\n");
         return;
     }
@@ -165,4 +196,5 @@ dealloc(usize ppn)
         sta.node[p] = sta.node[p << 1] & sta.node[(p << 1) | 1];
         p >>= 1;
     }
+    releaseSpinlockIrqrestore(&sta.lock, flags);
 }
\ No newline at end of file
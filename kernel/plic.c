@@ -0,0 +1,112 @@
+/*
+ *  kernel/plic.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * plic.c 是平台级中断控制器（PLIC）的驱动
+ *
+ * 每个 hart 的 S-Mode 有一个独立的上下文，包括中断源使能位、优先级阈值和 claim/complete 寄存器
+ * 优先级大于阈值且被使能的中断源会向该 hart 发出外部中断
+ * 设备驱动通过 registerIrq 注册处理函数，外部中断发生时按 claim 得到的中断源分发
+ * 一次外部中断会处理所有等待中的中断源，处理完成后写回 complete
+ */
+
+#include "types.h"
+#include "def.h"
+#include "consts.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "plic.h"
+
+/* PLIC 寄存器 */
+#define PLIC(offset)            (*(volatile uint32 *)(PLIC_BASE + KERNEL_MAP_OFFSET + (offset)))
+#define PLIC_PRIORITY(irq)      PLIC(4 * (irq))
+#define PLIC_ENABLE(ctx, irq)   PLIC(0x2000 + 0x80 * (ctx) + 4 * ((irq) / 32))
+#define PLIC_THRESHOLD(ctx)     PLIC(0x200000 + 0x1000 * (ctx))
+#define PLIC_CLAIM(ctx)         PLIC(0x200004 + 0x1000 * (ctx))
+
+/* QEMU virt 平台中 hart 的 S-Mode 上下文编号，偶数为 M-Mode 上下文 */
+#define SCONTEXT(hart)          (2 * (hart) + 1)
+
+/* 各中断源的处理函数 */
+static void (* handlers[PLIC_NSOURCES])(int);
+
+/* 保护使能位的读改写 */
+static Spinlock plicLock;
+
+void
+initPlic()
+{
+    initSpinlock(&plicLock, "plic");
+    int irq;
+    for(irq = 1; irq < PLIC_NSOURCES; irq ++) {
+        PLIC_PRIORITY(irq) = 0;
+    }
+}
+
+/* 每个 hart 都需要进行的初始化，关闭所有中断源并接收所有优先级的中断 */
+void
+initHartPlic()
+{
+    int ctx = SCONTEXT(cpuid());
+    int i;
+    for(i = 0; i < PLIC_NSOURCES / 32; i ++) {
+        PLIC(0x2000 + 0x80 * ctx + 4 * i) = 0;
+    }
+    PLIC_THRESHOLD(ctx) = 0;
+}
+
+/* 使能 hart 上的中断源 */
+void
+enableIrq(int irq, int hart)
+{
+    usize flags = acquireSpinlockIrqsave(&plicLock);
+    PLIC_ENABLE(SCONTEXT(hart), irq) |= 1U << (irq % 32);
+    releaseSpinlockIrqrestore(&plicLock, flags);
+}
+
+void
+disableIrq(int irq, int hart)
+{
+    usize flags = acquireSpinlockIrqsave(&plicLock);
+    PLIC_ENABLE(SCONTEXT(hart), irq) &= ~(1U << (irq % 32));
+    releaseSpinlockIrqrestore(&plicLock, flags);
+}
+
+/*
+ * 注册中断源的处理函数，并设置优先级
+ * 中断源被使能到当前 hart
+ */
+void
+registerIrq(int irq, int priority, void (* handler)(int))
+{
+    if(irq <= 0 || irq >= PLIC_NSOURCES || priority <= 0 || priority > PLIC_PRIORITY_MAX) {
+        panic("registerIrq: invalid irq or priority");
+    }
+    handlers[irq] = handler;
+    PLIC_PRIORITY(irq) = priority;
+    enableIrq(irq, cpuid());
+}
+
+/*
+ * 处理外部中断
+ * 反复 claim 直到没有等待中的中断源，每个中断源处理完成后写回 complete
+ * 没有注册处理函数的中断源被关闭，防止反复触发
+ */
+void
+handlePlic()
+{
+    int ctx = SCONTEXT(cpuid());
+    uint32 irq;
+    while((irq = PLIC_CLAIM(ctx)) != 0) {
+        if(irq < PLIC_NSOURCES && handlers[irq]) {
+            handlers[irq](irq);
+        } else {
+            printf("Unexpected external interrupt %d\n", irq);
+            PLIC_PRIORITY(irq) = 0;
+        }
+        PLIC_CLAIM(ctx) = irq;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef _PLIC_H
+#define _PLIC_H
+
+#include "types.h"
+
+/* QEMU virt 平台的 PLIC 物理地址和大小 */
+#define PLIC_BASE           0x0C000000
+#define PLIC_SIZE           0x400000
+
+#define PLIC_NSOURCES       128     /* 支持的中断源数量，0 号中断源保留 */
+#define PLIC_PRIORITY_MAX   7       /* 中断源的最高优先级，0 表示不会触发 */
+
+/* QEMU virt 平台的中断源编号 */
+#define VIRTIO0_IRQ         1
+#define UART0_IRQ           10
+
+void initPlic();
+void initHartPlic();
+void registerIrq(int irq, int priority, void (* handler)(int));
+void enableIrq(int irq, int hart);
+void disableIrq(int irq, int hart);
+void handlePlic();
+
+#endif
@@ -15,8 +15,35 @@
 
 static char digits[] = "0123456789abcdef";
 
+/*
+ * 输出缓冲区，每次 printf 的输出先放入缓冲区，结束时整段输出
+ * 缓冲区满时提前输出
+ */
+#define PRINT_BUF_SIZE 128
+
+typedef struct {
+    char buf[PRINT_BUF_SIZE];
+    int len;
+} PrintBuf;
+
+static void
+flush(PrintBuf *pb)
+{
+    if (pb->len > 0)
+        uartWrite(pb->buf, pb->len);
+    pb->len = 0;
+}
+
+static void
+putc(PrintBuf *pb, char c)
+{
+    pb->buf[pb->len++] = c;
+    if (pb->len == PRINT_BUF_SIZE)
+        flush(pb);
+}
+
 static void
-printint(int xx, int base, int sign)
+printint(PrintBuf *pb, int xx, int base, int sign)
 {
     char buf[16];
     int i;
@@ -37,17 +64,17 @@ printint(int xx, int base, int sign)
         buf[i++] = '-';
 
     while (--i >= 0)
-        consolePutchar(buf[i]);
+        putc(pb, buf[i]);
 }
 
 static void
-printptr(usize x)
+printptr(PrintBuf *pb, usize x)
 {
     int i;
-    consolePutchar('0');
-    consolePutchar('x');
+    putc(pb, '0');
+    putc(pb, 'x');
     for (i = 0; i < (sizeof(usize) * 2); i++, x <<= 4)
-        consolePutchar(digits[x >> (sizeof(usize) * 8 - 4)]);
+        putc(pb, digits[x >> (sizeof(usize) * 8 - 4)]);
 }
 
 void printf(char *fmt, ...)
@@ -55,14 +82,16 @@ void printf(char *fmt, ...)
     va_list ap;
     int i, c;
     char *s;
+    PrintBuf pb;
 
     if (fmt == 0)
         panic("null fmt");
 
+    pb.len = 0;
     va_start(ap, fmt);
     for (i = 0; (c = fmt[i] & 0xff) != 0; i++) {
         if (c != '%') {
-            consolePutchar(c);
+            putc(&pb, c);
             continue;
         }
         c = fmt[++i] & 0xff;
@@ -70,29 +99,31 @@ void printf(char *fmt, ...)
             break;
         switch (c) {
             case 'd':
-                printint(va_arg(ap, int), 10, 1);
+                printint(&pb, va_arg(ap, int), 10, 1);
                 break;
             case 'x':
-                printint(va_arg(ap, int), 16, 1);
+                printint(&pb, va_arg(ap, int), 16, 1);
                 break;
             case 'p':
-                printptr(va_arg(ap, usize));
+                printptr(&pb, va_arg(ap, usize));
                 break;
             case 's':
                 if ((s = va_arg(ap, char *)) == 0)
                     s = "(null)";
                 for (; *s; s++)
-                    consolePutchar(*s);
+                    putc(&pb, *s);
                 break;
             case '%':
-                consolePutchar('%');
+                putc(&pb, '%');
                 break;
             default:
-                consolePutchar('%');
-                consolePutchar(c);
+                putc(&pb, '%');
+                putc(&pb, c);
                 break;
         }
     }
+    va_end(ap);
+    flush(&pb);
 }
 
 void panic(char *s)
@@ -100,5 +131,6 @@ void panic(char *s)
     printf("panic: ");
     printf(s);
     printf("\n");
+    uartFlush();
     shutdown();
 }
\ No newline at end of file
@@ -4,35 +4,252 @@
  *  (C) 2021  Ziyang Guo
  */
 
+/*
+ * 每个 hart 对应一个 Processor，各自调度属于自己的线程
+ * 所有 hart 共享同一个线程池，线程只会被加入所属 hart 的调度器
+ * 唤醒其他 hart 上的线程时，通过核间中断请求该 hart 完成唤醒
+ *
+ * 线程只能在亲和性掩码允许的 hart 上运行
+ * 休眠的线程被唤醒时可能迁移到负载更小的 hart，但缓存仍热的线程倾向于留在原来的 hart
+ *
+ * 系统调用期间中断是打开的，内核代码随时可能在中断返回时被抢占，除非：
+ *   关闭了中断，此时中断不会发生
+ *   抢占计数不为 0（例如持有自旋锁），此时只记录调度请求，计数归零时再调度
+ * 长时间运行的内核循环中调用 preemptPoint，处理积压的调度请求
+ */
+
 #include "types.h"
 #include "def.h"
 #include "thread.h"
 #include "riscv.h"
 #include "condition.h"
 #include "fs.h"
+#include "timer.h"
+#include "ipi.h"
+
+/* 所有 hart 共享的线程池 */
+static ThreadPool POOL;
 
-/* 全局唯一的 Processor 实例 */
-static Processor CPU;
+/* 每个 hart 的 Processor 实例，以 hartid 为下标 */
+static Processor CPUS[NCPU];
+
+/* 当前 hart 的 Processor */
+static Processor *
+myCPU()
+{
+    return &CPUS[cpuid()];
+}
 
+/* 由启动 hart 调用，初始化共享的线程池 */
 void
-initCPU(Thread idle, ThreadPool pool)
+initCPU(ThreadPool pool)
 {
-    CPU.idle = idle;
-    CPU.pool = pool;
-    CPU.occupied = 0;
+    POOL = pool;
+    initTicketLock(&POOL.lock, "pool");
 }
 
-/* 让线程参与 CPU 调度 */
+/* 由每个 hart 调用，初始化自己的调度器实例和 idle 线程 */
+void
+initHartCPU(Thread idle)
+{
+    Processor *cpu = myCPU();
+    POOL.scheduler.init();
+    cpu->idle = idle;
+    cpu->current = 0;
+    cpu->occupied = 0;
+    cpu->exited = 0;
+    cpu->preemptCount = 0;
+    cpu->needResched = 0;
+    cpu->started = 1;
+}
+
+/*
+ * 启动其他 hart
+ * 每个 hart 使用新分配的栈完成初始化，之后切换进自己的 idle 线程
+ * 不存在的 hart 启动失败，不参与调度
+ */
 void
+startHarts()
+{
+    extern void _secondaryStart();
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        if(i == cpuid()) {
+            continue;
+        }
+        usize stack = (usize)kalloc(KERNEL_STACK_SIZE);
+        if(startHart(i, (usize)_secondaryStart - KERNEL_MAP_OFFSET, stack + KERNEL_STACK_SIZE)) {
+            kfree((void *)stack);
+        }
+    }
+}
+
+/* hart 的负载，即正在运行和等待运行的线程数 */
+static int
+cpuLoad(int cpu)
+{
+    return POOL.readyCount[cpu] + CPUS[cpu].occupied;
+}
+
+/* 所有已启动 hart 的掩码 */
+static usize
+startedMask()
+{
+    usize mask = 0;
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        if(CPUS[i].started) {
+            mask |= 1UL << i;
+        }
+    }
+    return mask;
+}
+
+/*
+ * 在 affinity 允许的 hart 中选择负载最小的，负载相同时优先当前 hart
+ * 没有允许的 hart 时返回 -1
+ */
+static int
+pickCPU(usize affinity)
+{
+    int best = -1;
+    int i;
+    affinity &= startedMask();
+    if(affinity & (1UL << cpuid())) {
+        best = cpuid();
+    }
+    for(i = 0; i < NCPU; i ++) {
+        if((affinity & (1UL << i)) && (best == -1 || cpuLoad(i) < cpuLoad(best))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * 为被唤醒的线程选择 hart，调用者需要持有线程池的锁
+ * 原来的 hart 不再允许时必须迁移
+ * 否则只有负载不均衡足以抵消迁移的代价时才迁移，缓存仍热的线程需要更大的不均衡
+ */
+static int
+selectCPU(ThreadInfo *ti)
+{
+    int prev = ti->cpu;
+    int best = pickCPU(ti->thread.affinity);
+    if(best == -1) {
+        return prev;
+    }
+    if(!(ti->thread.affinity & (1UL << prev))) {
+        return best;
+    }
+    int hot = r_time() - ti->lastRan < MIGRATION_COST;
+    if(cpuLoad(prev) - cpuLoad(best) >= (hot ? MIGRATION_IMBALANCE : 1)) {
+        return best;
+    }
+    return prev;
+}
+
+/* 让线程参与 CPU 调度，返回线程的 tid，线程池没有空间时返回 -1 */
+int
 addToCPU(Thread thread)
 {
-    addToPool(&CPU.pool, thread);
+    /* 选择 hart 到加入调度之间不能迁移到其他 hart */
+    usize flags = disable_and_store();
+    int cpu = pickCPU(thread.affinity);
+    if(cpu == -1) {
+        cpu = cpuid();
+    }
+    int tid = addToPool(&POOL, thread, cpu);
+    if(tid == -1) {
+        restore_sstatus(flags);
+        return -1;
+    }
+    if(cpu != cpuid()) {
+        /* 线程属于其他 hart，由该 hart 将其加入调度 */
+        wakeupCPU(tid);
+    }
+    updateTimer();
+    restore_sstatus(flags);
+    return tid;
 }
 
 /* 
- * 调度线程的运行逻辑
- * 在线程用完时间片或线程结束后，会返回调度线程
- * 用于按照一定规则选择下一个要运行的线程
+ * 回收已退出线程的槽位和内核栈
+ * 线程退出时仍运行在自己的内核栈上，只能在切换到其他线程后再释放
+ */
+static void
+reapExited()
+{
+    Processor *cpu = myCPU();
+    if(cpu->exited) {
+        kfree((void *)cpu->exited->thread.kstack);
+        releaseFpu(&cpu->exited->thread);
+        freeToPool(&POOL, cpu->exited);
+        cpu->exited = 0;
+    }
+}
+
+/*
+ * 切换到 next 线程
+ * next 可能刚在其他 hart 上交还线程池，需要等待其上下文保存完成
+ * switch.asm 在上下文保存完成后才写入 contextAddr
+ */
+static void
+switchToThread(Thread *self, ThreadInfo *next)
+{
+    /* 记录进程在该 hart 上运行过，取消映射时需要刷新该 hart 的 TLB */
+    __atomic_fetch_or(&next->thread.process->cpuMask, 1UL << cpuid(), __ATOMIC_SEQ_CST);
+    while(!__atomic_load_n(&next->thread.contextAddr, __ATOMIC_ACQUIRE)) {}
+    switchThread(self, &next->thread);
+}
+
+/*
+ * 在当前线程中直接完成调度
+ * 将当前线程交还线程池后选出下一个线程，并直接切换过去
+ * 只有在没有可运行线程时才切换到 idle 线程
+ * 调用前需要关闭异步中断
+ */
+static void
+schedule()
+{
+    Processor *cpu = myCPU();
+    reapExited();
+    ThreadInfo *prev = cpu->current;
+    if(!prev->occupied) {
+        /* 当前线程已经退出，切换走之后再回收其槽位和内核栈 */
+        cpu->exited = prev;
+    }
+    if(retrieveToPool(&POOL, prev)) {
+        /* 当前 hart 已不在线程的亲和性掩码中，唤醒到其他 hart 上继续运行 */
+        wakeupCPU(prev->tid);
+    }
+
+    ThreadInfo *next = acquireFromPool(&POOL);
+    if(next == prev) {
+        /* 唯一可运行的就是当前线程，无需切换 */
+        updateTimer();
+        return;
+    }
+    if(next) {
+        /* 直接切换到下一个线程，上下文保存在各自的线程池槽位中 */
+        cpu->current = next;
+        updateTimer();
+        switchToThread(&prev->thread, next);
+    } else {
+        /* 无线程可运行，进入 idle 等待中断 */
+        cpu->occupied = 0;
+        updateTimer();
+        switchThread(&prev->thread, &cpu->idle);
+    }
+
+    /* 某个时刻再切回此线程时从这里开始 */
+    reapExited();
+}
+
+/* 
+ * idle 线程的运行逻辑
+ * 只有在没有可运行线程时才会切换到 idle 线程
+ * idle 线程等待中断，一旦有线程可以运行就切换过去
  */
 void
 idleMain()
@@ -42,112 +259,254 @@ idleMain()
      * 防止调度过程本身被时钟中断打断
      */
     disable_and_store();
+    Processor *cpu = myCPU();
     while(1) {
+        reapExited();
         /* 从线程池获取一个可运行的线程 */
-        RunningThread rt = acquireFromPool(&CPU.pool);
-        if(rt.tid != -1) {
-            /* 有线程可以运行就切换到该线程 */
-            CPU.current = rt;
-            CPU.occupied = 1;
-            switchThread(&CPU.idle, &CPU.current.thread);
-
+        ThreadInfo *next = acquireFromPool(&POOL);
+        if(next) {
             /*
-             * 线程用尽时间片或运行结束
-             * 切换回 idle 线程处，修改线程状态，进行下一次调度
+             * 有线程可以运行就切换到该线程
+             * 之后的调度由线程之间直接完成，直到再次无线程可运行
              */
-            CPU.occupied = 0;
-            retrieveToPool(&CPU.pool, CPU.current);
-        } else {
+            cpu->current = next;
+            cpu->occupied = 1;
+            updateTimer();
+            switchToThread(&cpu->idle, next);
+        } else if(!stealFromPool(&POOL)) {
             /* 
-             * 当前无可运行线程
-             * 开启异步中断响应并处理
+             * 当前无可运行线程，也无法从其他 hart 取得线程
+             * 停止抢占时钟，开启异步中断响应并处理
              */
+            updateTimer();
             enable_and_wfi();
             disable_and_store();
         }
     }
 }
 
-/* 时钟中断发生时，CPU 检查正在运行程序的时间片 */
+/*
+ * 当前 hart 有线程在排队时，通知一个空闲的 hart 来取走线程
+ * 排队的线程缓存冷却后，空闲 hart 才会取走，因此在时钟中断中检查
+ */
+static void
+kickIdleCPU()
+{
+    int i;
+    if(POOL.readyCount[cpuid()] == 0) {
+        return;
+    }
+    for(i = 0; i < NCPU; i ++) {
+        if(CPUS[i].started && !CPUS[i].occupied && POOL.readyCount[i] == 0) {
+            postIpi(i, IPI_RESCHED);
+            return;
+        }
+    }
+}
+
+/* 处理调度请求，调用前需要关闭异步中断且抢占计数为 0 */
+static void
+reschedule()
+{
+    Processor *cpu = myCPU();
+    cpu->needResched = 0;
+    if(cpu->occupied) {
+        /* 线程仍为 Running 状态，交还线程池后继续参与调度 */
+        schedule();
+    }
+}
+
+/*
+ * 时钟软中断中调用，CPU 检查正在运行程序的时间片
+ * 当前线程运行时间耗尽时只记录调度请求，由 preemptIrqExit 在中断返回前调度
+ */
 void
 tickCPU()
 {
-    if(CPU.occupied) {
-        /* 当前有正在运行线程（不是 idle） */
-        if(tickPool(&CPU.pool)) {
-            /* 
-             * 当前线程运行时间耗尽，切换回 idle
-             * 进入 idle 线程前需要关闭异步中断 
-             */
-            usize flags = disable_and_store();
-            switchThread(&CPU.current.thread, &CPU.idle);
+    kickIdleCPU();
+    Processor *cpu = myCPU();
+    /* 当前有正在运行线程（不是 idle） */
+    if(cpu->occupied && tickPool(&POOL)) {
+        cpu->needResched = 1;
+    }
+}
 
-            /* 某个时刻再切回此线程时从这里开始 */
-            restore_sstatus(flags);
-        }
+/*
+ * 异步中断返回前调用，调用时关闭了异步中断
+ * 处理中断期间产生的调度请求，禁止抢占期间留到计数归零时处理
+ */
+void
+preemptIrqExit()
+{
+    Processor *cpu = myCPU();
+    if(cpu->preemptCount == 0 && cpu->needResched) {
+        /* 某个时刻再切回此线程时从这里返回 */
+        reschedule();
+    }
+}
+
+/*
+ * 禁止抢占，可以嵌套
+ * 计数属于当前 hart，修改期间关闭中断，防止读取 hart 编号后被迁移
+ */
+void
+preemptDisable()
+{
+    usize flags = disable_and_store();
+    myCPU()->preemptCount ++;
+    restore_sstatus(flags);
+}
+
+/* 恢复抢占，计数归零且中断打开时处理积压的调度请求 */
+void
+preemptEnable()
+{
+    usize flags = disable_and_store();
+    Processor *cpu = myCPU();
+    cpu->preemptCount --;
+    if(cpu->preemptCount == 0 && cpu->needResched && (flags & SSTATUS_SIE)) {
+        reschedule();
     }
+    restore_sstatus(flags);
 }
 
-/* 由当前线程执行，退出线程并切换到 idle 线程 */
+/*
+ * 抢占点，在长时间运行的内核循环中调用
+ * 只在中断打开且允许抢占时才会让出 CPU，关闭中断的临界区中调用不产生影响
+ */
+void
+preemptPoint()
+{
+    usize flags = disable_and_store();
+    Processor *cpu = myCPU();
+    if(cpu->preemptCount == 0 && cpu->needResched && (flags & SSTATUS_SIE)) {
+        reschedule();
+    }
+    restore_sstatus(flags);
+}
+
+/*
+ * 判断当前 hart 是否需要抢占时钟
+ * 只有在正在运行的线程之外还有就绪线程时，时间片轮转才有意义
+ */
+int
+needPreemptTick()
+{
+    return myCPU()->occupied && POOL.readyCount[cpuid()] > 0;
+}
+
+/* 由当前线程执行，退出线程并切换到下一个线程 */
 void
 exitFromCPU(usize code)
 {
     disable_and_store();
-    int tid = CPU.current.tid;
-    exitFromPool(&CPU.pool, tid);
+    ThreadInfo *ti = myCPU()->current;
+    Thread *thread = &ti->thread;
+    int wait = exitFromPool(&POOL, ti->tid, code);
     
     /* 
      * 检查是否有线程在等待当前线程退出
      * 如果有就唤醒，让其参与调度
      */
-    if(CPU.current.thread.wait != -1) {
-        wakeupCPU(CPU.current.thread.wait);
+    if(wait != -1) {
+        wakeupCPU(wait);
+    }
+
+    /* 进程中还有其他线程，回收该线程的用户栈 */
+    if(thread->ustack != -1 && thread->process->refCount > 1) {
+        freeUserStack(thread->process, thread->ustack);
     }
 
-    switchThread(&CPU.current.thread, &CPU.idle);
+    /*
+     * 释放对所属进程的引用，最后一个线程退出时进程被回收
+     * 僵尸线程需要保留所属进程，用于检查等待者是否属于同一进程，槽位回收时再清除
+     */
+    releaseProcess(thread->process);
+
+    schedule();
 }
 
 void
 runCPU()
 {   
     /*
-     * 在启动线程的最后调用
-     * 从启动线程切换进 idle，boot 线程信息丢失，不会再回来
+     * 在每个 hart 启动的最后调用
+     * 从启动线程切换进 idle，启动线程信息丢失，不会再回来
      */
     Thread boot;
     boot.contextAddr = 0;
     boot.kstack = 0;
+    boot.process = 0;
     boot.wait = -1;
-    switchThread(&boot, &CPU.idle);
+    boot.fp = 0;
+    boot.vec = 0;
+    switchThread(&boot, &myCPU()->idle);
 }
 
 /* 当前线程主动放弃 CPU，并进入休眠 */
 void
 yieldCPU()
 {
-    if(CPU.occupied) {
-        /* 修改当前线程状态并切换到 idle 线程 */
-        usize flags = disable_and_store();
-        int tid = CPU.current.tid;
-        ThreadInfo *ti = &CPU.pool.threads[tid];
-        ti->status = Sleeping;
-        switchThread(&CPU.current.thread, &CPU.idle);
-
-        /* 从休眠中被唤醒时从该处开始执行 */
-        restore_sstatus(flags);
+    usize flags = disable_and_store();
+    Processor *cpu = myCPU();
+    if(cpu->occupied) {
+        /* 修改当前线程状态并调度下一个线程 */
+        cpu->current->status = Sleeping;
+        schedule();
     }
+    /* 从休眠中被唤醒时从该处开始执行 */
+    restore_sstatus(flags);
 }
 
 /* 
  * 将某个线程唤醒
- * 并使其参与调度
+ * 已经离开 hart 的线程先选择运行的 hart，再使其参与该 hart 的调度
  */
 void
 wakeupCPU(int tid)
 {
-    ThreadInfo *ti = &CPU.pool.threads[tid];
-    ti->status = Ready;
-    schedulerPush(tid);
+    /* 比较 hart 编号之后不能被迁移 */
+    usize irqFlags = disable_and_store();
+    usize flags = acquireTicketLockIrqsave(&POOL.lock);
+    ThreadInfo *ti = findInPool(&POOL, tid);
+    int cpu = -1;
+    if(ti) {
+        if(!ti->onCpu && ti->status == Sleeping) {
+            ti->cpu = selectCPU(ti);
+        }
+        cpu = ti->cpu;
+    }
+    releaseTicketLockIrqrestore(&POOL.lock, flags);
+    if(cpu == cpuid()) {
+        wakeupInPool(&POOL, tid);
+        updateTimer();
+    } else if(cpu != -1) {
+        ipiWakeup(cpu, ti);
+    }
+    restore_sstatus(irqFlags);
+}
+
+/*
+ * 处理其他 hart 通过核间中断发来的唤醒请求
+ * 发出请求之后线程的亲和性可能已经改变，不再允许在当前 hart 上运行时重新选择 hart
+ */
+void
+receiveWakeup(ThreadInfo *ti)
+{
+    if(ti->thread.affinity & (1UL << cpuid())) {
+        wakeupInPool(&POOL, ti->tid);
+    } else {
+        wakeupCPU(ti->tid);
+    }
+}
+
+/* 回收一个未能加入线程池的新线程的内核栈、用户栈和对进程的引用 */
+static void
+discardThread(Thread *t)
+{
+    kfree((void *)t->kstack);
+    freeUserStack(t->process, t->ustack);
+    releaseProcess(t->process);
 }
 
 /*
@@ -168,18 +527,177 @@ executeCPU(Inode *inode, int hostTid)
     Thread t = newUserThread(buf);
     t.wait = hostTid;
     kfree(buf);
-    addToCPU(t);
+    if(addToCPU(t) == -1) {
+        discardThread(&t);
+        return 0;
+    }
     return 1;
 }
 
+void
+dumpCPU()
+{
+    dumpPool(&POOL);
+}
+
+/*
+ * 在当前进程中创建一个新线程
+ * 新线程从 entry 开始运行，a0、a1 为 arg0、arg1
+ * 用户栈槽位、内核堆或物理内存用尽时返回 -1
+ */
+int
+cloneCPU(usize entry, usize arg0, usize arg1)
+{
+    Process *process = getCurrentThread()->process;
+    int slot = allocUserStack(process);
+    if(slot == -1) {
+        return -1;
+    }
+    Thread t = newCloneThread(process, slot, entry, arg0, arg1);
+    if(t.kstack == 0) {
+        freeUserStack(process, slot);
+        return -1;
+    }
+    /* 新线程继承创建者的亲和性 */
+    t.affinity = getCurrentThread()->affinity;
+    int tid = addToCPU(t);
+    if(tid == -1) {
+        discardThread(&t);
+    }
+    return tid;
+}
+
+/*
+ * 等待同一进程中的另一个线程退出，退出码保存在 code 中
+ * 目标线程已经退出但尚未被等待时直接取得退出码
+ * 目标线程不存在、属于其他进程或已有线程在等待时返回 -1
+ */
+int
+joinCPU(int tid, usize *code)
+{
+    /* 从登记到进入休眠之间不能被打断，否则可能错过目标线程退出时的唤醒 */
+    usize flags = disable_and_store();
+    ThreadInfo *self = myCPU()->current;
+    usize poolFlags = acquireTicketLockIrqsave(&POOL.lock);
+    ThreadInfo *ti = findInPool(&POOL, tid);
+    if(ti == 0) {
+        ti = findZombie(&POOL, tid);
+    }
+    if(ti == 0 || ti == self || (ti->thread.wait != -1 && ti->thread.wait != self->tid)
+        || ti->thread.process != self->thread.process) {
+        releaseTicketLockIrqrestore(&POOL.lock, poolFlags);
+        restore_sstatus(flags);
+        return -1;
+    }
+    /* 僵尸线程只由等待者或进程结束时回收，休眠期间槽位不会被重新分配 */
+    while(!ti->zombie) {
+        ti->thread.wait = self->tid;
+        releaseTicketLockIrqrestore(&POOL.lock, poolFlags);
+        yieldCPU();
+        poolFlags = acquireTicketLockIrqsave(&POOL.lock);
+    }
+    *code = ti->exitCode;
+    reapZombie(&POOL, ti);
+    releaseTicketLockIrqrestore(&POOL.lock, poolFlags);
+    restore_sstatus(flags);
+    return 0;
+}
+
+/* 进程结束时回收其中的僵尸线程 */
+void
+reapZombiesCPU(Process *process)
+{
+    reapZombies(&POOL, process);
+}
+
+/* 匹配指定 tid 的线程，用于从调度器队列中取出该线程 */
+static int
+isTid(int tid, void *arg)
+{
+    return tid == *(int *)arg;
+}
+
+/*
+ * 设置同一进程中线程的亲和性，tid 为 -1 表示当前线程
+ * mask 中不存在的 hart 被忽略，不包含任何可用 hart 时返回 -1
+ * 当前线程不再允许在当前 hart 上运行时立即迁移
+ * 在不允许的 hart 上排队的线程从队列中取出，唤醒到允许的 hart 上
+ * 正在其他 hart 上运行的线程在下一次调度时迁移
+ */
+int
+setAffinityCPU(int tid, usize mask)
+{
+    mask &= startedMask();
+    if(mask == 0) {
+        return -1;
+    }
+    usize flags = disable_and_store();
+    Processor *cpu = myCPU();
+    ThreadInfo *self = cpu->current;
+    usize poolFlags = acquireTicketLockIrqsave(&POOL.lock);
+    ThreadInfo *ti = tid == -1 ? self : findInPool(&POOL, tid);
+    if(ti == 0 || ti->thread.process != self->thread.process) {
+        releaseTicketLockIrqrestore(&POOL.lock, poolFlags);
+        restore_sstatus(flags);
+        return -1;
+    }
+    ti->thread.affinity = mask;
+    int migrate = 0;
+    if(ti->status == Ready && !(mask & (1UL << ti->cpu))
+        && POOL.scheduler.steal(ti->cpu, isTid, &ti->tid) != -1) {
+        /* 与 retrieveToPool 相同，线程先处于休眠状态，再唤醒到其他 hart */
+        POOL.readyCount[ti->cpu] --;
+        ti->status = Sleeping;
+        migrate = 1;
+    }
+    releaseTicketLockIrqrestore(&POOL.lock, poolFlags);
+    if(migrate) {
+        wakeupCPU(ti->tid);
+    }
+    if(ti == self && !(mask & (1UL << cpuid()))) {
+        /* 线程仍处于运行状态，交还线程池时会被唤醒到允许的 hart 上 */
+        schedule();
+    }
+    restore_sstatus(flags);
+    return 0;
+}
+
+/* 获取同一进程中线程的亲和性，tid 为 -1 表示当前线程，失败时返回 0 */
+usize
+getAffinityCPU(int tid)
+{
+    usize flags = acquireTicketLockIrqsave(&POOL.lock);
+    ThreadInfo *self = myCPU()->current;
+    ThreadInfo *ti = tid == -1 ? self : findInPool(&POOL, tid);
+    usize mask = 0;
+    if(ti && ti->thread.process == self->thread.process) {
+        mask = ti->thread.affinity & startedMask();
+    }
+    releaseTicketLockIrqrestore(&POOL.lock, flags);
+    return mask;
+}
+
+/*
+ * 以下函数可能在中断打开时调用
+ * 读取 hart 编号和该 hart 的当前线程之间不能被抢占，否则可能读到其他线程
+ */
 int
 getCurrentTid()
 {
-    return CPU.current.tid;
+    return getCurrentThreadInfo()->tid;
+}
+
+ThreadInfo *
+getCurrentThreadInfo()
+{
+    usize flags = disable_and_store();
+    ThreadInfo *ti = myCPU()->current;
+    restore_sstatus(flags);
+    return ti;
 }
 
 Thread
 *getCurrentThread()
 {
-    return &CPU.current.thread;
-}
\ No newline at end of file
+    return &getCurrentThreadInfo()->thread;
+}
@@ -31,11 +31,37 @@ w_sie(usize x)
     asm volatile("csrw sie, %0" : : "r" (x));
 }
 
+#define SIP_SSIP (1L << 1)  /* 软件中断等待位，核间中断通过该位通知 */
+/* 清除软件中断等待位 */
+static inline void
+clear_ssip()
+{
+    asm volatile("csrc sip, %0" : : "r" (SIP_SSIP));
+}
+
+/* 设置软件中断等待位，在当前 hart 上触发一次软件中断 */
+static inline void
+set_ssip()
+{
+    asm volatile("csrs sip, %0" : : "r" (SIP_SSIP));
+}
+
 #define SSTATUS_SUM (1L << 18)
+#define SSTATUS_FS  (3L << 13)  /* 浮点单元状态 */
+#define SSTATUS_VS  (3L << 9)   /* 向量单元状态 */
 #define SSTATUS_SPP (1L << 8)
 #define SSTATUS_SPIE (1L << 5)
 #define SSTATUS_SIE (1L << 1)   /* 监管者模式中断使能 */
 #define SSTATUS_UIE (1L << 0)   /* 用户模式中断使能 */
+/* FS、VS 字段的取值，Dirty 表示寄存器被修改过，需要保存 */
+#define FS_OFF      (0L << 13)
+#define FS_INITIAL  (1L << 13)
+#define FS_CLEAN    (2L << 13)
+#define FS_DIRTY    (3L << 13)
+#define VS_OFF      (0L << 9)
+#define VS_INITIAL  (1L << 9)
+#define VS_CLEAN    (2L << 9)
+#define VS_DIRTY    (3L << 9)
 /* 监管者模式状态寄存器 */
 static inline usize
 r_sstatus()
@@ -51,6 +77,15 @@ w_sstatus(usize x)
     asm volatile("csrw sstatus, %0" : : "r" (x));
 }
 
+/* 读取 CPU 周期计数 */
+static inline usize
+r_cycle()
+{
+    usize x;
+    asm volatile("csrr %0, cycle" : "=r" (x) );
+    return x;
+}
+
 /* 读取硬件时钟 */
 static inline usize
 r_time()
@@ -60,6 +95,24 @@ r_time()
     return x;
 }
 
+/*
+ * Sstc 扩展的 stimecmp 寄存器，time 不小于其值时产生时钟中断
+ * 使用 CSR 编号，旧版汇编器不认识寄存器名
+ */
+static inline usize
+r_stimecmp()
+{
+    usize x;
+    asm volatile("csrr %0, 0x14d" : "=r" (x) );
+    return x;
+}
+
+static inline void
+w_stimecmp(usize x)
+{
+    asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
 static inline uint64
 r_satp()
 {
@@ -68,6 +121,28 @@ r_satp()
     return x;
 }
 
+/* 内核中 tp 寄存器保存当前 hart 的编号 */
+static inline usize
+r_tp()
+{
+    usize x;
+    asm volatile("mv %0, tp" : "=r" (x) );
+    return x;
+}
+
+static inline void
+w_tp(usize x)
+{
+    asm volatile("mv tp, %0" : : "r" (x));
+}
+
+/* 当前 hart 的编号 */
+static inline int
+cpuid()
+{
+    return r_tp();
+}
+
 /* 打开异步中断，并等待中断 */
 static inline void
 enable_and_wfi()
@@ -6,94 +6,245 @@
 
 /*
  * rrscheduler.c 实现了 Round-robin 算法
- * 该实现规定了最大线程数量，以链表的形式将各个线程的信息连接起来
+ * 以链表的形式将各个线程的信息连接起来，链表节点以下标互相引用
  * tid 号线程的信息会被存放在数组的 tid + 1 处
+ * 数组容量不足时倍增，不限制最大线程数量
+ * 每个 hart 有一个独立的调度器实例，只调度属于该 hart 的线程
+ *
+ * 每个线程的时间片根据其行为自适应调整：
+ *   用尽时间片被抢占的线程（CPU 密集型）时间片翻倍，减少切换开销
+ *   很快就主动休眠的线程（交互型）时间片减半，被唤醒时插到队首优先运行
+ *
+ * 其他 hart 空闲时可以从队尾取走线程，队尾的线程最晚运行，迁移的损失最小
  */
 
 #include "types.h"
 #include "def.h"
 #include "thread.h"
+#include "riscv.h"
+#include "spinlock.h"
+
+#define MIN_SLICE       1   /* 最短时间片（时钟中断数） */
+#define DEFAULT_SLICE   2   /* 新线程的时间片 */
+#define MAX_SLICE       16  /* 最长时间片 */
 
 typedef struct
 {
     int valid;
-    usize time;
+    usize time;     /* 剩余时间片 */
+    usize slice;    /* 当前时间片长度，0 表示新线程 */
     int prev;
     int next;
 } RRInfo;
 
-struct
+typedef struct
 {
-    RRInfo threads[MAX_THREAD + 1];
-    usize maxTime;
+    RRInfo *threads;
+    int capacity;   /* threads 数组容量 */
     int current;
-} rrScheduler;
+    TicketLock lock;
+} RRScheduler;
+
+static RRScheduler rrSchedulers[NCPU];
 
+/* 由每个 hart 在启动时调用，初始化自己的调度器实例 */
 void
 schedulerInit()
 {
-    rrScheduler.maxTime = 1;
-    rrScheduler.current = 0;
+    RRScheduler *rr = &rrSchedulers[cpuid()];
+    initTicketLock(&rr->lock, "scheduler");
+    rr->capacity = THREAD_CHUNK_SIZE + 1;
+    rr->threads = kalloc(rr->capacity * sizeof(RRInfo));
+    rr->current = 0;
     /* 第 0 个位置为 Dummy head，用于快速找到链表头和尾 */
-    RRInfo ri = {0, 0L, 0, 0};
-    rrScheduler.threads[0] = ri;
+    RRInfo ri = {0, 0L, 0L, 0, 0};
+    rr->threads[0] = ri;
+}
+
+/* 扩展 threads 数组直到可以容纳下标 index */
+static void
+growRR(RRScheduler *rr, int index)
+{
+    int capacity = rr->capacity;
+    while(capacity <= index) {
+        capacity <<= 1;
+    }
+    RRInfo *threads = kalloc(capacity * sizeof(RRInfo));
+    int i;
+    for(i = 0; i < rr->capacity; i ++) {
+        threads[i] = rr->threads[i];
+    }
+    kfree(rr->threads);
+    rr->threads = threads;
+    rr->capacity = capacity;
+}
+
+/* 插入到队尾 */
+static void
+pushBackRR(RRScheduler *rr, int tid)
+{
+    int prev = rr->threads[0].prev;
+    rr->threads[tid].valid = 1;
+    rr->threads[prev].next = tid;
+    rr->threads[tid].prev = prev;
+    rr->threads[0].prev = tid;
+    rr->threads[tid].next = 0;
+}
+
+/* 插入到队首 */
+static void
+pushFrontRR(RRScheduler *rr, int tid)
+{
+    int next = rr->threads[0].next;
+    rr->threads[tid].valid = 1;
+    rr->threads[next].prev = tid;
+    rr->threads[tid].next = next;
+    rr->threads[0].next = tid;
+    rr->threads[tid].prev = 0;
 }
 
 void
 schedulerPush(int tid)
 {
+    RRScheduler *rr = &rrSchedulers[cpuid()];
     tid += 1;
-    if(tid + 1 > MAX_THREAD + 1) {
-        panic("Cannot push to scheduler!\n");
+    usize flags = acquireTicketLockIrqsave(&rr->lock);
+    if(tid >= rr->capacity) {
+        growRR(rr, tid);
     }
-    if(rrScheduler.threads[tid].time == 0) {
-        rrScheduler.threads[tid].time = rrScheduler.maxTime;
+    RRInfo *ri = &rr->threads[tid];
+    if(ri->slice == 0) {
+        /* 新线程 */
+        ri->slice = DEFAULT_SLICE;
+        ri->time = ri->slice;
+        pushBackRR(rr, tid);
+    } else if(ri->time == 0) {
+        /* 用尽时间片被抢占，延长时间片 */
+        if(ri->slice < MAX_SLICE) {
+            ri->slice <<= 1;
+        }
+        ri->time = ri->slice;
+        pushBackRR(rr, tid);
+    } else if((ri->slice - ri->time) * 2 < ri->slice) {
+        /* 时间片用掉不到一半就休眠，缩短时间片并在唤醒时优先运行 */
+        if(ri->slice > MIN_SLICE) {
+            ri->slice >>= 1;
+        }
+        ri->time = ri->slice;
+        pushFrontRR(rr, tid);
+    } else {
+        ri->time = ri->slice;
+        pushBackRR(rr, tid);
     }
-    int prev = rrScheduler.threads[0].prev;
-    rrScheduler.threads[tid].valid = 1;
-    rrScheduler.threads[prev].next = tid;
-    rrScheduler.threads[tid].prev = prev;
-    rrScheduler.threads[0].prev = tid;
-    rrScheduler.threads[tid].next = 0;
+    releaseTicketLockIrqrestore(&rr->lock, flags);
 }
 
 int
 schedulerPop()
 {
-    int ret = rrScheduler.threads[0].next;
+    RRScheduler *rr = &rrSchedulers[cpuid()];
+    usize flags = acquireTicketLockIrqsave(&rr->lock);
+    int ret = rr->threads[0].next;
     if(ret != 0) {
-        int next = rrScheduler.threads[ret].next;
-        int prev = rrScheduler.threads[ret].prev;
-        rrScheduler.threads[next].prev = prev;
-        rrScheduler.threads[prev].next = next;
-        rrScheduler.threads[ret].prev = 0;
-        rrScheduler.threads[ret].next = 0;
-        rrScheduler.threads[ret].valid = 0;
-        rrScheduler.current = ret;
+        int next = rr->threads[ret].next;
+        int prev = rr->threads[ret].prev;
+        rr->threads[next].prev = prev;
+        rr->threads[prev].next = next;
+        rr->threads[ret].prev = 0;
+        rr->threads[ret].next = 0;
+        rr->threads[ret].valid = 0;
+        rr->current = ret;
     }
+    releaseTicketLockIrqrestore(&rr->lock, flags);
     return ret-1;
 }
 
+/*
+ * 时间片用尽后禁止抢占期间调度会被推迟，时钟中断仍会到来
+ * 此时剩余时间片保持为 0，不能继续减少
+ */
 int
 schedulerTick()
 {
-    int tid = rrScheduler.current;
+    RRScheduler *rr = &rrSchedulers[cpuid()];
+    usize flags = acquireTicketLockIrqsave(&rr->lock);
+    int tid = rr->current;
+    int expired = 1;
     if(tid != 0) {
-        rrScheduler.threads[tid].time -= 1;
-        if(rrScheduler.threads[tid].time == 0) {
-            return 1;
-        } else {
-            return 0;
+        if(rr->threads[tid].time > 0) {
+            rr->threads[tid].time -= 1;
         }
+        expired = rr->threads[tid].time == 0;
     }
-    return 1;
+    releaseTicketLockIrqrestore(&rr->lock, flags);
+    return expired;
 }
 
+/*
+ * 线程退出，清空它在各个 hart 上的时间片信息，复用该 tid 的新线程重新开始计算
+ * 线程被唤醒到其他 hart 时不会清空原来 hart 上的信息，因此需要检查所有 hart
+ */
 void
 schedulerExit(int tid)
 {
     tid += 1;
-    if(rrScheduler.current == tid) {
-        rrScheduler.current = 0;
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        RRScheduler *rr = &rrSchedulers[i];
+        if(rr->threads == 0) {
+            continue;
+        }
+        usize flags = acquireTicketLockIrqsave(&rr->lock);
+        if(i == cpuid() && rr->current == tid) {
+            rr->current = 0;
+        }
+        if(tid < rr->capacity) {
+            rr->threads[tid].slice = 0;
+            rr->threads[tid].time = 0;
+        }
+        releaseTicketLockIrqrestore(&rr->lock, flags);
+    }
+}
+
+/* 获取线程在 cpu 号 hart 上的时间片长度 */
+usize
+schedulerSlice(int cpu, int tid)
+{
+    RRScheduler *rr = &rrSchedulers[cpu];
+    usize flags = acquireTicketLockIrqsave(&rr->lock);
+    usize slice = 0;
+    if(tid + 1 < rr->capacity) {
+        slice = rr->threads[tid + 1].slice;
+    }
+    releaseTicketLockIrqrestore(&rr->lock, flags);
+    return slice;
+}
+
+/*
+ * 从 cpu 号 hart 的队列中取出一个 movable 认为可以迁移的线程
+ * 从队尾向前查找，没有可迁移的线程时返回 -1
+ */
+int
+schedulerSteal(int cpu, int (* movable)(int, void *), void *arg)
+{
+    RRScheduler *rr = &rrSchedulers[cpu];
+    usize flags = acquireTicketLockIrqsave(&rr->lock);
+    int tid = rr->threads[0].prev;
+    while(tid != 0 && !movable(tid - 1, arg)) {
+        tid = rr->threads[tid].prev;
+    }
+    if(tid != 0) {
+        int next = rr->threads[tid].next;
+        int prev = rr->threads[tid].prev;
+        rr->threads[next].prev = prev;
+        rr->threads[prev].next = next;
+        rr->threads[tid].prev = 0;
+        rr->threads[tid].next = 0;
+        rr->threads[tid].valid = 0;
+        /* 线程离开该 hart，之后再回来时重新计算时间片 */
+        rr->threads[tid].slice = 0;
+        rr->threads[tid].time = 0;
     }
-}
\ No newline at end of file
+    releaseTicketLockIrqrestore(&rr->lock, flags);
+    return tid - 1;
+}
@@ -10,18 +10,64 @@
 
 #include "types.h"
 #include "def.h"
+#include "consts.h"
 #include "sbi.h"
 
+/* 新版 SBI 调用，成功时返回 a1 中的值，失败返回 -1 */
+static long
+sbiCallValue(usize ext, usize fid, usize arg0, usize arg1, usize arg2)
+{
+    register unsigned long a0 asm("a0") = arg0;
+    register unsigned long a1 asm("a1") = arg1;
+    register unsigned long a2 asm("a2") = arg2;
+    register unsigned long a6 asm("a6") = fid;
+    register unsigned long a7 asm("a7") = ext;
+    asm volatile("ecall"
+                 : "+r"(a0), "+r"(a1)
+                 : "r"(a2), "r"(a6), "r"(a7)
+                 : "memory");
+    return a0 ? -1 : (long)a1;
+}
+
 void
 consolePutchar(usize c)
 {
     SBI_ECALL_1(SBI_CONSOLE_PUTCHAR, c);
 }
 
-usize
-consoleGetchar()
+/* 是否支持 DBCN 扩展，-1 表示尚未检测 */
+static int hasDbcn = -1;
+
+/*
+ * 输出一段字符串
+ * 支持 DBCN 扩展时整段交给 SBI 输出，参数为缓冲区的物理地址，可能只输出一部分，需要循环
+ * 否则退回到逐字符输出，buf 必须位于内核的线性映射中
+ */
+void
+consoleWrite(char *buf, usize len)
 {
-    return SBI_ECALL_0(SBI_CONSOLE_GETCHAR);
+    if(hasDbcn < 0) {
+        /* 使用 BASE 扩展的 probe_extension 检测 */
+        hasDbcn = sbiCallValue(SBI_EXT_BASE, 3, SBI_EXT_DBCN, 0, 0) > 0;
+    }
+    if(hasDbcn) {
+        usize paddr = (usize)buf - KERNEL_MAP_OFFSET;
+        while(len > 0) {
+            long written = sbiCallValue(SBI_EXT_DBCN, 0, len, paddr, 0);
+            if(written <= 0) {
+                break;
+            }
+            paddr += written;
+            len -= written;
+        }
+        if(len == 0) {
+            return;
+        }
+        buf = (char *)(paddr + KERNEL_MAP_OFFSET);
+    }
+    while(len -- > 0) {
+        consolePutchar(*buf ++);
+    }
 }
 
 void
@@ -35,4 +81,31 @@ void
 setTimer(usize time)
 {
     SBI_ECALL_1(SBI_SET_TIMER, time);
+}
+
+/* 向 hartMask 中的 hart 发送核间中断 */
+void
+sendIpi(usize hartMask)
+{
+    SBI_ECALL_EXT(SBI_EXT_IPI, 0, hartMask, 0, 0, 0);
+}
+
+/*
+ * 在 hartMask 中的 hart 上执行 sfence.vma，刷新 [start, start + size) 的 TLB
+ * 所有目标 hart 完成刷新后才返回
+ */
+void
+remoteSfenceVma(usize hartMask, usize start, usize size)
+{
+    SBI_ECALL_EXT(SBI_EXT_RFENCE, 1, hartMask, 0, start, size);
+}
+
+/*
+ * 启动一个 hart，从物理地址 startAddr 开始以 S-Mode 执行
+ * 此时 a0 为 hartid，a1 为 opaque，成功返回 0
+ */
+int
+startHart(usize hartid, usize startAddr, usize opaque)
+{
+    return SBI_ECALL_EXT(SBI_EXT_HSM, 0, hartid, startAddr, opaque, 0);
 }
\ No newline at end of file
@@ -12,6 +12,13 @@
 #define SBI_REMOTE_SFENCE_VMA_ASID  0x7
 #define SBI_SHUTDOWN                0x8
 
+/* 新版 SBI 扩展号，a7 为扩展号，a6 为功能号 */
+#define SBI_EXT_IPI                 0x735049
+#define SBI_EXT_RFENCE              0x52464E43
+#define SBI_EXT_HSM                 0x48534D
+#define SBI_EXT_BASE                0x10
+#define SBI_EXT_DBCN                0x4442434E
+
 #define SBI_ECALL(__num, __a0, __a1, __a2)                                    \
 	({                                                                    \
 		register unsigned long a0 asm("a0") = (unsigned long)(__a0);  \
@@ -30,4 +37,23 @@
 #define SBI_ECALL_1(__num, __a0) SBI_ECALL(__num, __a0, 0, 0)
 #define SBI_ECALL_2(__num, __a0, __a1) SBI_ECALL(__num, __a0, __a1, 0)
 
+/*
+ * 新版 SBI 调用，返回 a0 中的错误码，0 表示成功
+ * a1 中的返回值目前不需要
+ */
+#define SBI_ECALL_EXT(__ext, __fid, __a0, __a1, __a2, __a3)                  \
+	({                                                                    \
+		register unsigned long a0 asm("a0") = (unsigned long)(__a0);  \
+		register unsigned long a1 asm("a1") = (unsigned long)(__a1);  \
+		register unsigned long a2 asm("a2") = (unsigned long)(__a2);  \
+		register unsigned long a3 asm("a3") = (unsigned long)(__a3);  \
+		register unsigned long a6 asm("a6") = (unsigned long)(__fid); \
+		register unsigned long a7 asm("a7") = (unsigned long)(__ext); \
+		asm volatile("ecall"                                          \
+			     : "+r"(a0), "+r"(a1)                             \
+			     : "r"(a2), "r"(a3), "r"(a6), "r"(a7)             \
+			     : "memory");                                     \
+		a0;                                                           \
+	})
+
 #endif
@@ -0,0 +1,86 @@
+/*
+ *  kernel/softirq.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * softirq.c 实现了中断的下半部（软中断）
+ *
+ * 硬件中断处理函数只完成应答设备、取出数据等必须立即完成的工作，其余工作通过 raiseSoftirq 推迟
+ * 异步中断返回前调用 irqExit，打开中断处理所有等待中的软中断，之后再处理调度请求
+ * 软中断处理期间禁止抢占，不会切换线程，嵌套的中断返回时不会重复进入软中断
+ * 一次处理的轮数有上限，剩余的软中断通过软件中断等待位在下一次中断返回时继续处理
+ */
+
+#include "types.h"
+#include "def.h"
+#include "consts.h"
+#include "riscv.h"
+#include "softirq.h"
+
+#define MAX_SOFTIRQ_RESTART 8   /* 每次中断返回最多处理的轮数 */
+
+static void (* handlers[NR_SOFTIRQ])();
+
+static usize pending[NCPU];     /* 每个 hart 等待处理的软中断 */
+static int inSoftirq[NCPU];     /* hart 是否正在处理软中断 */
+
+/* 注册软中断的处理函数 */
+void
+openSoftirq(int nr, void (* handler)())
+{
+    handlers[nr] = handler;
+}
+
+/* 在当前 hart 上触发软中断，在下一次中断返回时处理 */
+void
+raiseSoftirq(int nr)
+{
+    usize flags = disable_and_store();
+    __atomic_fetch_or(&pending[cpuid()], 1UL << nr, __ATOMIC_RELAXED);
+    restore_sstatus(flags);
+}
+
+/* 处理当前 hart 上所有等待中的软中断，调用时关闭了异步中断 */
+static void
+doSoftirq()
+{
+    int cpu = cpuid();
+    int restart = MAX_SOFTIRQ_RESTART;
+    inSoftirq[cpu] = 1;
+    preemptDisable();
+    usize set;
+    while(restart -- > 0 && (set = __atomic_exchange_n(&pending[cpu], 0, __ATOMIC_RELAXED))) {
+        w_sstatus(r_sstatus() | SSTATUS_SIE);
+        int nr;
+        for(nr = 0; nr < NR_SOFTIRQ; nr ++) {
+            if((set & (1UL << nr)) && handlers[nr]) {
+                handlers[nr]();
+            }
+        }
+        disable_and_store();
+    }
+    preemptEnable();
+    inSoftirq[cpu] = 0;
+    if(pending[cpu]) {
+        /* 处理轮数达到上限，触发一次软件中断，返回后尽快继续处理 */
+        set_ssip();
+    }
+}
+
+/*
+ * 异步中断返回前调用，调用时关闭了异步中断
+ * 嵌套在软中断中的中断直接返回，由外层继续处理
+ */
+void
+irqExit()
+{
+    if(inSoftirq[cpuid()]) {
+        return;
+    }
+    if(pending[cpuid()]) {
+        doSoftirq();
+    }
+    extern void preemptIrqExit(); preemptIrqExit();
+}
@@ -0,0 +1,15 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+
+/* 软中断编号，数值越小越先处理 */
+#define SOFTIRQ_TIMER       0       /* 时钟事件和时间片 */
+#define SOFTIRQ_SERIAL      1       /* 串口输入 */
+#define NR_SOFTIRQ          8
+
+void openSoftirq(int nr, void (* handler)());
+void raiseSoftirq(int nr);
+void irqExit();
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ *  kernel/spinlock.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * spinlock.c 实现了自旋锁和排队自旋锁（ticket lock）
+ * 自旋锁通过 amoswap 抢占，竞争激烈时可能有线程长时间拿不到锁
+ * 排队自旋锁先取号再等待叫号，按到达的顺序获取
+ *
+ * 仅关闭中断只能保护单个 hart 上的数据，多个 hart 共享的数据必须加锁
+ * 会在中断处理中访问的数据应当使用 Irqsave 版本，避免持有锁时被中断后在同一 hart 上死锁
+ * 持有锁期间禁止抢占，防止持有者被切换走后其他线程在同一 hart 上自旋
+ */
+
+#include "types.h"
+#include "def.h"
+#include "riscv.h"
+#include "spinlock.h"
+
+/* 所有锁的统计信息链表 */
+static LockStat *lockList;
+static Spinlock listLock;
+
+static void
+registerLock(LockStat *stat, char *name)
+{
+    stat->name = name;
+    stat->acquisitions = 0;
+    stat->contended = 0;
+    stat->spins = 0;
+    stat->maxHold = 0;
+    stat->holdStart = 0;
+    usize flags = acquireSpinlockIrqsave(&listLock);
+    stat->next = lockList;
+    lockList = stat;
+    releaseSpinlockIrqrestore(&listLock, flags);
+}
+
+/* 获取锁之后调用，spins 为等待时自旋的次数 */
+static inline void
+statAcquired(LockStat *stat, usize spins)
+{
+#if LOCK_STAT
+    stat->acquisitions ++;
+    if(spins) {
+        stat->contended ++;
+        stat->spins += spins;
+    }
+    stat->holdStart = r_cycle();
+#endif
+}
+
+/* 释放锁之前调用 */
+static inline void
+statReleasing(LockStat *stat)
+{
+#if LOCK_STAT
+    usize hold = r_cycle() - stat->holdStart;
+    if(hold > stat->maxHold) {
+        stat->maxHold = hold;
+    }
+#endif
+}
+
+void
+initSpinlock(Spinlock *lock, char *name)
+{
+    lock->locked = 0;
+    registerLock(&lock->stat, name);
+}
+
+void
+acquireSpinlock(Spinlock *lock)
+{
+    usize spins = 0;
+    preemptDisable();
+    while(__sync_lock_test_and_set(&lock->locked, 1)) {
+        /* 锁被占用时只读等待，减少对总线的争用 */
+        do {
+            spins ++;
+        } while(__atomic_load_n(&lock->locked, __ATOMIC_RELAXED));
+    }
+    statAcquired(&lock->stat, spins);
+}
+
+void
+releaseSpinlock(Spinlock *lock)
+{
+    statReleasing(&lock->stat);
+    __sync_lock_release(&lock->locked);
+    preemptEnable();
+}
+
+/* 关闭中断并获取锁，返回原先的 sstatus */
+usize
+acquireSpinlockIrqsave(Spinlock *lock)
+{
+    usize flags = disable_and_store();
+    acquireSpinlock(lock);
+    return flags;
+}
+
+void
+releaseSpinlockIrqrestore(Spinlock *lock, usize flags)
+{
+    releaseSpinlock(lock);
+    restore_sstatus(flags);
+}
+
+void
+initTicketLock(TicketLock *lock, char *name)
+{
+    lock->next = 0;
+    lock->owner = 0;
+    registerLock(&lock->stat, name);
+}
+
+void
+acquireTicketLock(TicketLock *lock)
+{
+    preemptDisable();
+    uint32 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    usize spins = 0;
+    while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        spins ++;
+    }
+    statAcquired(&lock->stat, spins);
+}
+
+void
+releaseTicketLock(TicketLock *lock)
+{
+    statReleasing(&lock->stat);
+    /* 只有持有者会修改 owner，不需要原子加 */
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+    preemptEnable();
+}
+
+usize
+acquireTicketLockIrqsave(TicketLock *lock)
+{
+    usize flags = disable_and_store();
+    acquireTicketLock(lock);
+    return flags;
+}
+
+void
+releaseTicketLockIrqrestore(TicketLock *lock, usize flags)
+{
+    releaseTicketLock(lock);
+    restore_sstatus(flags);
+}
+
+/* 输出所有锁的竞争统计 */
+void
+dumpLocks()
+{
+#if LOCK_STAT
+    usize flags = acquireSpinlockIrqsave(&listLock);
+    LockStat *stat;
+    printf("LOCK\t\tACQUIRE\tCONTEND\tSPINS\tMAXHOLD\n");
+    for(stat = lockList; stat; stat = stat->next) {
+        printf("%s\t\t%d\t%d\t%d\t%d\n", stat->name, (int)stat->acquisitions,
+            (int)stat->contended, (int)stat->spins, (int)stat->maxHold);
+    }
+    releaseSpinlockIrqrestore(&listLock, flags);
+#else
+    printf("Lock statistics are disabled\n");
+#endif
+}
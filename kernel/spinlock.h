@@ -0,0 +1,48 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "consts.h"
+
+/*
+ * 锁的竞争统计
+ * 只在 LOCK_STAT 开启时更新，所有初始化过的锁通过 next 串成链表
+ */
+typedef struct lockStat {
+    char *name;
+    usize acquisitions;     /* 获取次数 */
+    usize contended;        /* 需要等待的获取次数 */
+    usize spins;            /* 等待时自旋的总次数 */
+    usize maxHold;          /* 最长持有时间（cycle） */
+    usize holdStart;        /* 本次获取的时刻 */
+    struct lockStat *next;
+} LockStat;
+
+/* 自旋锁，不保证获取的顺序 */
+typedef struct {
+    uint32 locked;
+    LockStat stat;
+} Spinlock;
+
+/* 排队自旋锁，按取号顺序获取 */
+typedef struct {
+    uint32 next;            /* 下一个可取的号 */
+    uint32 owner;           /* 当前持有锁的号 */
+    LockStat stat;
+} TicketLock;
+
+void initSpinlock(Spinlock *lock, char *name);
+void acquireSpinlock(Spinlock *lock);
+void releaseSpinlock(Spinlock *lock);
+usize acquireSpinlockIrqsave(Spinlock *lock);
+void releaseSpinlockIrqrestore(Spinlock *lock, usize flags);
+
+void initTicketLock(TicketLock *lock, char *name);
+void acquireTicketLock(TicketLock *lock);
+void releaseTicketLock(TicketLock *lock);
+usize acquireTicketLockIrqsave(TicketLock *lock);
+void releaseTicketLockIrqrestore(TicketLock *lock, usize flags);
+
+void dumpLocks();
+
+#endif
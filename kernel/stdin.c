@@ -4,48 +4,103 @@
  *  (C) 2021  Ziyang Guo
  */
 
+/*
+ * 标准输入缓冲区是一个固定大小的单生产者环形缓冲区
+ * 生产者只有终端行规程（串口软中断，只在启动 hart 上运行），写入时不需要加锁
+ * 读取的线程之间用 lock 互斥，对生产者而言相当于只有一个消费者
+ * 一次串口中断提交的所有字符只唤醒一次等待的线程
+ */
+
 #include "types.h"
 #include "def.h"
-#include "queue.h"
+#include "riscv.h"
 #include "condition.h"
+#include "spinlock.h"
+
+#define STDIN_BUF_SIZE  1024    /* 必须是 2 的幂 */
 
 /* 
  * 全局唯一标准输入缓冲区
- * buf 为输入字符缓冲
+ * head 由生产者写入，tail 由持有 lock 的消费者写入
  * pushed 为条件变量（等待输入的线程）
  */
 struct
 {
-    Queue buf;
+    char buf[STDIN_BUF_SIZE];
+    uint32 head;
+    uint32 tail;
     Condvar pushed;
+    Spinlock lock;
 } STDIN;
 
+void
+initStdin()
+{
+    initSpinlock(&STDIN.lock, "stdin");
+}
+
 /*
- * 将一个字符放入标准输入缓冲区
- * 并唤醒一个等待字符的线程
+ * 将 len 个字符整体放入标准输入缓冲区，剩余空间不足时全部丢弃并返回 0
+ * 读取者不会看到只提交了一部分的行
+ * 不唤醒等待的线程，一批字符放入后调用 wakeStdin
  */
+int
+pushChars(char *buf, usize len)
+{
+    uint32 head = STDIN.head;
+    if(STDIN_BUF_SIZE - (head - __atomic_load_n(&STDIN.tail, __ATOMIC_ACQUIRE)) < len) {
+        return 0;
+    }
+    usize i;
+    for(i = 0; i < len; i ++) {
+        STDIN.buf[(head + i) & (STDIN_BUF_SIZE - 1)] = buf[i];
+    }
+    __atomic_store_n(&STDIN.head, head + len, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* 缓冲区中有字符时唤醒所有等待输入的线程，由它们重新检查缓冲区 */
 void
-pushChar(char ch)
+wakeStdin()
 {
-    pushBack(&STDIN.buf, (usize)ch);
-    notifyCondition(&STDIN.pushed);
+    if(__atomic_load_n(&STDIN.head, __ATOMIC_ACQUIRE) != STDIN.tail) {
+        notifyAll(&STDIN.pushed);
+    }
+}
+
+static int
+hasChar(void *arg)
+{
+    return __atomic_load_n(&STDIN.head, __ATOMIC_ACQUIRE)
+        != __atomic_load_n(&STDIN.tail, __ATOMIC_RELAXED);
 }
 
 /*
- * 线程请求从 stdin 中获取一个输入的字符
- * 如果当前缓冲区为空，线程会进入等待队列，并挂起自己
- * 在之后的某个时刻被唤醒时，缓冲区必然有字符，就可以顺利返回
+ * 从缓冲区中取出最多 len 个字符，遇到换行符时停止
+ * 缓冲区为空时线程进入等待队列，被唤醒后重新检查缓冲区
+ * 字符可能在检查之后被其他 hart 上的线程取走，因此取出时需要再次检查
+ * 返回取出的字符数
  */
-char
-popChar()
+usize
+popChars(char *buf, usize len)
 {
-    /* 实际上第二次循环就能顺利返回 */
     while(1) {
-        if(!isEmpty(&STDIN.buf)) {
-            char ret = (char)popFront(&STDIN.buf);
-            return ret;
-        } else {
-            waitCondition(&STDIN.pushed);
+        waitPredicate(&STDIN.pushed, hasChar, 0, 0);
+        usize flags = acquireSpinlockIrqsave(&STDIN.lock);
+        uint32 tail = STDIN.tail;
+        uint32 head = __atomic_load_n(&STDIN.head, __ATOMIC_ACQUIRE);
+        usize n = 0;
+        while(n < len && tail != head) {
+            buf[n] = STDIN.buf[tail & (STDIN_BUF_SIZE - 1)];
+            tail ++;
+            if(buf[n ++] == '\n') {
+                break;
+            }
+        }
+        __atomic_store_n(&STDIN.tail, tail, __ATOMIC_RELEASE);
+        releaseSpinlockIrqrestore(&STDIN.lock, flags);
+        if(n > 0) {
+            return n;
         }
     }
-}
\ No newline at end of file
+}
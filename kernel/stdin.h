@@ -1,7 +1,10 @@
 #ifndef _STDIN_H
 #define _STDIN_H
 
-void pushChar(char ch);
-char popChar();
+#include "types.h"
+
+int pushChars(char *buf, usize len);
+void wakeStdin();
+usize popChars(char *buf, usize len);
 
 #endif
\ No newline at end of file
@@ -11,9 +11,9 @@
     sd  \reg, \offset*REG_SIZE(sp)
 .endm
 
-# 将寄存器 s_n 保存到栈的 (n+2) * REGSIZE 位置
+# 将寄存器 s_n 保存到栈的 (n+1) * REGSIZE 位置
 .macro SAVE_N n
-    SAVE  s\n, (\n+2)
+    SAVE  s\n, (\n+1)
 .endm
 
 # 宏：从栈中恢复寄存器
@@ -22,13 +22,11 @@
 .endm
 
 .macro LOAD_N n
-    LOAD  s\n, (\n+2)
+    LOAD  s\n, (\n+1)
 .endm
 
     # 分配栈空间，用于保存 ThreadContext
     addi    sp, sp, (-REG_SIZE*14)
-    # 更新入参的当前线程栈顶地址
-    sd      sp, 0(a0)
     # 依次保存各个寄存器的值
     SAVE    ra, 0
     .set    n, 0
@@ -36,15 +34,14 @@
         SAVE_N  %n
         .set    n, n + 1
     .endr
-    csrr    s11, satp
-    SAVE    s11, 1
+    # 上下文保存完毕后才更新入参的当前线程栈顶地址
+    # 其他 hart 看到该地址非 0 时，即可切换到该线程
+    fence   rw, w
+    sd      sp, 0(a0)
 
     # 准备恢复到目标线程，首先切换栈
+    # 页表已由 switchThread 按需切换
     ld      sp, 0(a1)
-    LOAD    s11, 1
-    # 恢复页表寄存器并刷新 TLB
-    csrw    satp, s11
-    sfence.vma
     # 依次加载各个寄存器
     LOAD    ra, 0
     .set    n, 0
@@ -10,28 +10,104 @@
 #include "stdin.h"
 #include "thread.h"
 #include "fs.h"
+#include "riscv.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "mapping.h"
 
-const usize SYS_SHUTDOWN = 13;
-const usize SYS_LSDIR    = 20;
-const usize SYS_CDDIR    = 21;
-const usize SYS_PWD      = 22;
-const usize SYS_OPEN     = 56;
-const usize SYS_CLOSE    = 57;
-const usize SYS_READ     = 63;
-const usize SYS_WRITE    = 64;
-const usize SYS_EXIT     = 93;
-const usize SYS_EXEC     = 221;
+/* 系统调用号，与 interrupt.asm 中的 SYSCALL_COUNT 一起决定系统调用表的大小 */
+enum {
+    SYS_SHUTDOWN = 13,
+    SYS_LSDIR    = 20,
+    SYS_CDDIR    = 21,
+    SYS_PWD      = 22,
+    SYS_PS       = 23,
+    SYS_JOIN     = 24,
+    SYS_FUTEX_WAIT = 25,
+    SYS_FUTEX_WAKE = 26,
+    SYS_LOCKSTAT = 27,
+    SYS_OPEN     = 56,
+    SYS_CLOSE    = 57,
+    SYS_READ     = 63,
+    SYS_WRITE    = 64,
+    SYS_EXIT     = 93,
+    SYS_NANOSLEEP = 101,
+    SYS_SCHED_SETAFFINITY = 122,
+    SYS_SCHED_GETAFFINITY = 123,
+    SYS_CLONE    = 220,
+    SYS_EXEC     = 221,
+};
 
+#define SYSCALL_COUNT   256
+
+/*
+ * 从文件 fd 读取最多 len 个字节到用户缓冲区 base，返回读取的字节数，出错返回 -1
+ * 终端：规范模式下每次最多读取一行，先读入内核缓冲区再复制
+ * 复制时逐页检查用户缓冲区，非法地址返回 -1，已经读取的输入被丢弃
+ */
 usize
-sysRead(usize fd, uint8 *base, usize len) {
-    *base = (uint8)popChar();
-    return 1;
+sysRead(usize fd, usize base, usize len)
+{
+    Process *process = getCurrentThread()->process;
+    if(fd >= 16 || !process->fdOccupied[fd]) {
+        return -1;
+    }
+    switch(process->oFile[fd].fdType) {
+    case FD_CONSOLE:
+    {
+        Mapping m = {process->satp & ((1L << 44) - 1)};
+        char buf[256];
+        extern usize ttyRead(char *buf, usize len);
+        usize n = ttyRead(buf, len < sizeof(buf) ? len : sizeof(buf));
+        if(copyToUser(m, base, buf, n) < 0) {
+            return -1;
+        }
+        return n;
+    }
+    default:
+        return -1;
+    }
+}
+
+/*
+ * 将用户缓冲区 [base, base + len) 写入文件 fd，返回写入的字节数，出错返回 -1
+ * 终端：分段复制到内核缓冲区后整段输出，一次系统调用完成全部输出
+ * 用户缓冲区逐页检查，非法地址返回 -1，已经输出的部分不会撤回
+ * 文件系统是只读的，不能写入普通文件
+ */
+usize
+sysWrite(usize fd, usize base, usize len)
+{
+    Process *process = getCurrentThread()->process;
+    if(fd >= 16 || !process->fdOccupied[fd]) {
+        return -1;
+    }
+    switch(process->oFile[fd].fdType) {
+    case FD_CONSOLE:
+    {
+        Mapping m = {process->satp & ((1L << 44) - 1)};
+        char buf[256];
+        usize done = 0;
+        while(done < len) {
+            usize n = len - done < sizeof(buf) ? len - done : sizeof(buf);
+            if(copyFromUser(m, buf, base + done, n) < 0) {
+                return -1;
+            }
+            uartWrite(buf, n);
+            done += n;
+            preemptPoint();
+        }
+        return len;
+    }
+    default:
+        return -1;
+    }
 }
 
 usize
 sysExec(char *path, int fd)
 {
-    Inode *current = getCurrentThread()->process.oFile[fd].inode;
+    Inode *current = getCurrentThread()->process->oFile[fd].inode;
     Inode *inode = lookup(current, path);
     if(inode == 0) {
         printf("Command not found!\n");
@@ -46,7 +122,7 @@ sysExec(char *path, int fd)
 usize
 sysLsDir(char *path, int fd)
 {
-    Inode *current = getCurrentThread()->process.oFile[fd].inode;
+    Inode *current = getCurrentThread()->process->oFile[fd].inode;
     Inode *inode;
     if(*path == 0) {
         inode = current;
@@ -64,7 +140,7 @@ sysLsDir(char *path, int fd)
 usize
 sysCdDir(char *path, int fd)
 {
-    Inode *current = getCurrentThread()->process.oFile[fd].inode;
+    Inode *current = getCurrentThread()->process->oFile[fd].inode;
     Inode *inode = lookup(current, path);
     if(inode == 0) {
         printf("cd: No such file or directory\n");
@@ -74,31 +150,30 @@ sysCdDir(char *path, int fd)
         printf("%s: is not a directory!\n", inode->filename);
         return 0;
     }
-    getCurrentThread()->process.oFile[fd].inode = inode;
+    getCurrentThread()->process->oFile[fd].inode = inode;
     return 0;
 }
 
 int
 sysOpen(char *path)
 {
-    Thread *thread = getCurrentThread();
-    int fd = allocFd(thread);
+    Process *process = getCurrentThread()->process;
+    int fd = allocFd(process);
     if(fd == -1) {
         panic("Max file open!\n");
     }
-    thread->process.fdOccupied[fd] = 1;
-    File file;
-    file.fdType = FD_INODE;
-    file.offset = 0;
-    file.inode = lookup(0, path);
-    thread->process.oFile[fd] = file;
+    process->fdOccupied[fd] = 1;
+    File *file = &process->oFile[fd];
+    file->fdType = FD_INODE;
+    file->offset = 0;
+    file->inode = lookup(0, path);
     return fd;
 }
 
 void
 sysPwd(int fd)
 {
-    Inode *current = getCurrentThread()->process.oFile[fd].inode;
+    Inode *current = getCurrentThread()->process->oFile[fd].inode;
     char buf[256];
     char *path = getInodePath(current, buf);
     printf("%s\n", path);
@@ -107,46 +182,197 @@ sysPwd(int fd)
 void
 sysClose(int fd)
 {
-    Thread *thread = getCurrentThread();
-    deallocFd(thread, fd);
+    deallocFd(getCurrentThread()->process, fd);
 }
 
+/*
+ * 休眠用户地址 req 处的 TimeSpec 指定的时长，参数非法时返回 -1
+ * 时长过大时截断，避免计算截止时刻时溢出
+ */
 usize
-syscall(usize id, usize args[3], InterruptContext *context)
+sysNanosleep(usize req)
 {
-    switch (id)
-    {
-    case SYS_SHUTDOWN:
-        shutdown();
-        return 0;
-    case SYS_LSDIR:
-        sysLsDir((char *)args[0], args[1]);
-        return 0;
-    case SYS_CDDIR:
-        sysCdDir((char *)args[0], args[1]);
-        return 0;
-    case SYS_OPEN:
-        return sysOpen((char *)args[0]);
-    case SYS_PWD:
-        sysPwd(args[0]);
-        return 0;
-    case SYS_CLOSE:
-        sysClose(args[0]);
-        return 0;
-    case SYS_READ:
-        return sysRead(args[0], (uint8 *)args[1], args[2]);
-    case SYS_WRITE:
-        consolePutchar(args[0]);
-        return 0;
-    case SYS_EXIT:
-        exitFromCPU(args[0]);
-        return 0;
-    case SYS_EXEC:
-        sysExec((char *)args[0], args[1]);
-        return 0;
-    default:
-        printf("Unknown syscall id %d\n", id);
-        panic("");
+    Process *process = getCurrentThread()->process;
+    Mapping m = {process->satp & ((1L << 44) - 1)};
+    TimeSpec ts;
+    if(req == 0 || copyFromUser(m, (char *)&ts, req, sizeof(ts)) < 0 || ts.nsec >= 1000000000) {
         return -1;
     }
-}
\ No newline at end of file
+    if(ts.sec > ((usize)-1 >> 1) / TIMEBASE_FREQ) {
+        ts.sec = ((usize)-1 >> 1) / TIMEBASE_FREQ;
+    }
+    usize time = ts.sec * TIMEBASE_FREQ + ts.nsec / (1000000000 / TIMEBASE_FREQ);
+    if(time) {
+        sleepUntil(r_time() + time);
+    }
+    return 0;
+}
+
+/*
+ * 以下函数将 a0、a1、a2 三个参数转换为各个系统调用的参数
+ * 所有系统调用都通过系统调用表以统一的形式调用
+ */
+static usize
+callShutdown(usize a0, usize a1, usize a2)
+{
+    shutdown();
+}
+
+static usize
+callLsDir(usize a0, usize a1, usize a2)
+{
+    return sysLsDir((char *)a0, a1);
+}
+
+static usize
+callCdDir(usize a0, usize a1, usize a2)
+{
+    return sysCdDir((char *)a0, a1);
+}
+
+static usize
+callPwd(usize a0, usize a1, usize a2)
+{
+    sysPwd(a0);
+    return 0;
+}
+
+static usize
+callPs(usize a0, usize a1, usize a2)
+{
+    dumpCPU();
+    return 0;
+}
+
+/* 等待 a0 号线程退出，a1 不为 0 时将退出码写入 a1 指向的用户地址 */
+static usize
+callJoin(usize a0, usize a1, usize a2)
+{
+    usize code;
+    if(joinCPU(a0, &code) < 0) {
+        return -1;
+    }
+    if(a1) {
+        Process *process = getCurrentThread()->process;
+        Mapping m = {process->satp & ((1L << 44) - 1)};
+        if(copyToUser(m, a1, (char *)&code, sizeof(code)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static usize
+callFutexWait(usize a0, usize a1, usize a2)
+{
+    return futexWait((uint32 *)a0, a1, a2);
+}
+
+static usize
+callFutexWake(usize a0, usize a1, usize a2)
+{
+    return futexWake((uint32 *)a0, a1);
+}
+
+static usize
+callLockStat(usize a0, usize a1, usize a2)
+{
+    dumpLocks();
+    return 0;
+}
+
+static usize
+callOpen(usize a0, usize a1, usize a2)
+{
+    return sysOpen((char *)a0);
+}
+
+static usize
+callClose(usize a0, usize a1, usize a2)
+{
+    sysClose(a0);
+    return 0;
+}
+
+static usize
+callRead(usize a0, usize a1, usize a2)
+{
+    return sysRead(a0, a1, a2);
+}
+
+static usize
+callWrite(usize a0, usize a1, usize a2)
+{
+    return sysWrite(a0, a1, a2);
+}
+
+static usize
+callExit(usize a0, usize a1, usize a2)
+{
+    exitFromCPU(a0);
+    return 0;
+}
+
+static usize
+callNanosleep(usize a0, usize a1, usize a2)
+{
+    return sysNanosleep(a0);
+}
+
+static usize
+callSetAffinity(usize a0, usize a1, usize a2)
+{
+    return setAffinityCPU(a0, a1);
+}
+
+static usize
+callGetAffinity(usize a0, usize a1, usize a2)
+{
+    return getAffinityCPU(a0);
+}
+
+static usize
+callClone(usize a0, usize a1, usize a2)
+{
+    return cloneCPU(a0, a1, a2);
+}
+
+static usize
+callExec(usize a0, usize a1, usize a2)
+{
+    return sysExec((char *)a0, a1);
+}
+
+/*
+ * 系统调用表，以系统调用号为下标，空项为未定义的系统调用
+ * interrupt.asm 的快速路径直接按 a7 查表调用，不经过 handleInterrupt
+ */
+usize (* const syscallTable[SYSCALL_COUNT])(usize, usize, usize) = {
+    [SYS_SHUTDOWN]          = callShutdown,
+    [SYS_LSDIR]             = callLsDir,
+    [SYS_CDDIR]             = callCdDir,
+    [SYS_PWD]               = callPwd,
+    [SYS_PS]                = callPs,
+    [SYS_JOIN]              = callJoin,
+    [SYS_FUTEX_WAIT]        = callFutexWait,
+    [SYS_FUTEX_WAKE]        = callFutexWake,
+    [SYS_LOCKSTAT]          = callLockStat,
+    [SYS_OPEN]              = callOpen,
+    [SYS_CLOSE]             = callClose,
+    [SYS_READ]              = callRead,
+    [SYS_WRITE]             = callWrite,
+    [SYS_EXIT]              = callExit,
+    [SYS_NANOSLEEP]         = callNanosleep,
+    [SYS_SCHED_SETAFFINITY] = callSetAffinity,
+    [SYS_SCHED_GETAFFINITY] = callGetAffinity,
+    [SYS_CLONE]             = callClone,
+    [SYS_EXEC]              = callExec,
+};
+
+/* 未定义的系统调用 */
+void
+unknownSyscall(usize id)
+{
+    printf("Unknown syscall id %d\n", id);
+    panic("");
+}
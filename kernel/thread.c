@@ -13,11 +13,17 @@
 #include "mapping.h"
 #include "fs.h"
 
+/*
+ * 用户线程的内核栈顶预留 16 字节
+ * 第一个字保存线程所在 hart 的编号，从 U-Mode 进入中断时由 interrupt.asm 恢复到 tp
+ */
+#define KSTACK_RESERVED 16
+
+/* 将线程的内核栈分配在内核堆中，空间不足时返回 0 */
 usize
 newKernelStack()
 {
-    /* 将内核线程的线程栈分配在内核堆中 */
-    usize bottom = (usize)kalloc(KERNEL_STACK_SIZE);
+    usize bottom = (usize)tryKalloc(KERNEL_STACK_SIZE);
     return bottom;
 }
 
@@ -33,12 +39,38 @@ switchContext(usize *self, usize *target)
     asm volatile(".include \"kernel/switch.asm\"");
 }
 
+/*
+ * 每个 hart 当前加载的 satp
+ * 内核线程没有自己的地址空间，直接借用 hart 上已经加载的映射，所有用户映射中都包含内核
+ * 被借用的页表在进程回收后仍然有效（进程回收时不释放页表），内核线程也不会访问用户地址
+ */
+static usize activeSatp[NCPU];
+
+/*
+ * 切换到目标线程
+ * 只有目标线程属于另一个地址空间时才写入 satp 并刷新 TLB
+ * 同一进程内的线程切换以及进出 idle 都不再刷新 TLB
+ */
 void
 switchThread(Thread *self, Thread *target)
 {
+    usize satp = target->process ? target->process->satp : 0;
+    int cpu = cpuid();
+    if(satp != 0 && satp != activeSatp[cpu]) {
+        activeSatp[cpu] = satp;
+        asm volatile("csrw satp, %0; sfence.vma" : : "r" (satp) : "memory");
+    }
+    switchFpu(self, target);
     switchContext(&self->contextAddr, &target->contextAddr);
 }
 
+/* 用户线程从 U-Mode 进入中断时保存的上下文，位于内核栈顶预留空间之下 */
+InterruptContext *
+userContext(Thread *thread)
+{
+    return (InterruptContext *)(thread->kstack + KERNEL_STACK_SIZE - KSTACK_RESERVED - sizeof(InterruptContext));
+}
+
 usize
 pushContextToStack(ThreadContext tc, InterruptContext ic, usize stackTop)
 {
@@ -54,7 +86,7 @@ pushContextToStack(ThreadContext tc, InterruptContext ic, usize stackTop)
 }
 
 usize
-newKernelThreadContext(usize entry, usize kernelStackTop, usize satp)
+newKernelThreadContext(usize entry, usize kernelStackTop)
 {
     /*
      * 创建新的内核线程
@@ -72,43 +104,135 @@ newKernelThreadContext(usize entry, usize kernelStackTop, usize satp)
     ic.sstatus &= ~SSTATUS_SIE;
     ThreadContext tc;
     extern void __restore(); tc.ra = (usize)__restore;
-    tc.satp = satp;
     return pushContextToStack(tc, ic, kernelStackTop);
 }
 
+/*
+ * 创建用户线程上下文
+ * arg0 和 arg1 为线程开始运行时 a0 和 a1 寄存器的值
+ */
 usize
-newUserThreadContext(usize entry, usize ustackTop, usize kstackTop, usize satp)
+newUserThreadContext(usize entry, usize ustackTop, usize kstackTop, usize arg0, usize arg1)
 {
     InterruptContext ic;
     /* 新线程使用的栈为用户栈 */
     ic.x[2] = ustackTop;
+    ic.x[10] = arg0;
+    ic.x[11] = arg1;
     ic.sepc = entry;
     ic.sstatus = r_sstatus();
     /* 用户线程，返回后的特权级为 U-Mode */
     ic.sstatus &= ~SSTATUS_SPP;
     ic.sstatus |= SSTATUS_SPIE;
     ic.sstatus &= ~SSTATUS_SIE;
+    /* 浮点和向量单元初始关闭，第一次使用时再分配上下文 */
+    ic.sstatus &= ~(SSTATUS_FS | SSTATUS_VS);
     ThreadContext tc;
     extern void __restore(); tc.ra = (usize)__restore;
-    tc.satp = satp;
     return pushContextToStack(tc, ic, kstackTop);
 }
 
+/*
+ * 创建一个新进程，引用计数初始为 1
+ * 0、1、2 号文件描述符默认被标准输入输出占用
+ */
+Process *
+newProcess(usize satp)
+{
+    Process *p = kalloc(sizeof(Process));
+    p->satp = satp;
+    int i;
+    for(i = 0; i < 3; i ++) {
+        p->fdOccupied[i] = 1;
+        p->oFile[i].fdType = FD_CONSOLE;
+    }
+    p->refCount = 1;
+    p->stackSlots = 0;
+    p->cpuMask = 0;
+    p->zombies = 0;
+    return p;
+}
+
+/* 增加一个线程对进程的引用 */
+void
+acquireProcess(Process *process)
+{
+    __atomic_add_fetch(&process->refCount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * 释放一个线程对进程的引用，没有线程引用时回收进程
+ * 此时已没有线程能够等待进程中的僵尸线程，一并回收它们的槽位
+ */
+void
+releaseProcess(Process *process)
+{
+    if(__atomic_sub_fetch(&process->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        reapZombiesCPU(process);
+        kfree(process);
+    }
+}
+
+/* 获取进程的地址空间 */
+static Mapping
+processMapping(Process *process)
+{
+    Mapping m = {process->satp & ((1L << 44) - 1)};
+    return m;
+}
+
+/*
+ * 用户栈槽位对应的虚拟地址段
+ * 相邻的用户栈之间留出一页不映射的保护页
+ */
+static Segment
+userStackSegment(int slot)
+{
+    usize bottom = USER_STACK_OFFSET + slot * (USER_STACK_SIZE + PAGE_SIZE);
+    Segment s = {bottom, bottom + USER_STACK_SIZE, 1L | USER | READABLE | WRITABLE};
+    return s;
+}
+
+/*
+ * 在进程中分配一个空闲的用户栈槽位，没有空闲槽位时返回 -1
+ * 同一进程的线程可能在不同 hart 上同时分配，需要原子地占用槽位
+ */
+int
+allocUserStack(Process *process)
+{
+    int i;
+    for(i = 0; i < MAX_USER_STACK; i ++) {
+        usize old = __atomic_fetch_or(&process->stackSlots, 1L << i, __ATOMIC_ACQ_REL);
+        if(!(old & (1L << i))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* 取消用户栈的映射并释放槽位 */
+void
+freeUserStack(Process *process, int slot)
+{
+    unmapFramedSegment(processMapping(process), userStackSegment(slot), process->cpuMask);
+    __atomic_and_fetch(&process->stackSlots, ~(1L << slot), __ATOMIC_ACQ_REL);
+}
+
 Thread
 newKernelThread(usize entry)
 {
     usize stackBottom = newKernelStack();
-    Process p;
-    p.satp = r_satp();
-    int i;
-    for(i = 0; i < 3; i ++) p.fdOccupied[i] = 1;
+    if(stackBottom == 0) {
+        panic("Kernel stack depleted!\n");
+    }
+    /* 内核线程的 satp 为 0，运行时借用当前 hart 的映射 */
+    Process *p = newProcess(0);
     usize contextAddr = newKernelThreadContext(
         entry,
-        stackBottom + KERNEL_STACK_SIZE,
-        p.satp
+        stackBottom + KERNEL_STACK_SIZE
     );
     Thread t = {
-        contextAddr, stackBottom, p, -1
+        contextAddr, stackBottom, p, -1, -1, ALL_HARTS
     };
     return t;
 }
@@ -118,24 +242,54 @@ newUserThread(char *data)
 {
     /* 解析 ELF 文件，完成内核和可执行程序各个段的映射 */
     Mapping m = newUserMapping(data);
-    usize ustackBottom = USER_STACK_OFFSET, ustackTop = USER_STACK_OFFSET + USER_STACK_SIZE;
-    /* 映射用户栈 */
-    Segment s = {ustackBottom, ustackTop, 1L | USER | READABLE | WRITABLE};
+    Process *p = newProcess(m.rootPpn | (8L << 60));
+    /* 映射用户栈，主线程使用第 0 个槽位 */
+    int slot = allocUserStack(p);
+    Segment s = userStackSegment(slot);
     mapFramedSegment(m, s);
 
     usize kstack = newKernelStack();
+    if(kstack == 0) {
+        panic("Kernel stack depleted!\n");
+    }
     usize entryAddr = ((ElfHeader *)data)->entry;
-    Process p;
-    p.satp = m.rootPpn | (8L << 60);
-    int i;
-    for(i = 0; i < 3; i ++) p.fdOccupied[i] = 1;
     usize context = newUserThreadContext(
         entryAddr,
-        ustackTop,
-        kstack + KERNEL_STACK_SIZE,
-        p.satp
+        s.endVaddr,
+        kstack + KERNEL_STACK_SIZE - KSTACK_RESERVED,
+        0, 0
     );
-    Thread t = {context, kstack, p, -1};
+    Thread t = {context, kstack, p, -1, slot, ALL_HARTS};
+    return t;
+}
+
+/*
+ * 在已有进程中创建一个新线程
+ * 新线程与进程中的其他线程共享地址空间和文件描述符，使用 slot 号用户栈
+ * 从 entry 处开始运行，a0 和 a1 分别为 arg0 和 arg1
+ * 内存不足时返回的线程 kstack 为 0，已经映射的用户栈由调用者通过 freeUserStack 回收
+ */
+Thread
+newCloneThread(Process *process, int slot, usize entry, usize arg0, usize arg1)
+{
+    Thread none = {0, 0, 0, -1, -1, ALL_HARTS};
+    Segment s = userStackSegment(slot);
+    if(tryMapFramedSegment(processMapping(process), s) < 0) {
+        return none;
+    }
+
+    usize kstack = newKernelStack();
+    if(kstack == 0) {
+        return none;
+    }
+    acquireProcess(process);
+    usize context = newUserThreadContext(
+        entry,
+        s.endVaddr,
+        kstack + KERNEL_STACK_SIZE - KSTACK_RESERVED,
+        arg0, arg1
+    );
+    Thread t = {context, kstack, process, -1, slot, ALL_HARTS};
     return t;
 }
 
@@ -149,10 +303,23 @@ newBootThread()
     Thread t;
     t.contextAddr = 0L;
     t.kstack = 0L;
+    t.process = 0;
     t.wait = -1;
+    t.ustack = -1;
+    t.affinity = ALL_HARTS;
+    t.fp = 0;
+    t.vec = 0;
     return t;
 }
 
+/* 每个 hart 初始化自己的调度器实例和 idle 线程 */
+void
+initHartThread()
+{
+    Thread idle = newKernelThread((usize)idleMain);
+    initHartCPU(idle);
+}
+
 void
 initThread()
 {
@@ -161,12 +328,13 @@ initThread()
         schedulerPush,
         schedulerPop,
         schedulerTick,
-        schedulerExit
+        schedulerExit,
+        schedulerSlice,
+        schedulerSteal
     };
-    s.init();
     ThreadPool pool = newThreadPool(s);
-    Thread idle = newKernelThread((usize)idleMain);
-    initCPU(idle, pool);
+    initCPU(pool);
+    initHartThread();
 
     /* 启动终端 */
     Inode *shInode = lookup(0, "/bin/sh");
@@ -180,11 +348,11 @@ initThread()
 }
 
 int
-allocFd(Thread *thread)
+allocFd(Process *process)
 {
     int i = 0;
     for(i = 0; i < 16; i ++) {
-        if(!thread->process.fdOccupied[i]) {
+        if(!process->fdOccupied[i]) {
             return i;
         }
     }
@@ -192,7 +360,7 @@ allocFd(Thread *thread)
 }
 
 void
-deallocFd(Thread *thread, int fd)
+deallocFd(Process *process, int fd)
 {
-    thread->process.fdOccupied[fd] = 0;
+    process->fdOccupied[fd] = 0;
 }
\ No newline at end of file
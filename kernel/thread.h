@@ -5,22 +5,44 @@
 #include "context.h"
 #include "consts.h"
 #include "condition.h"
+#include "timer.h"
 #include "file.h"
+#include "spinlock.h"
 
-/* 进程为资源分配的单位，保存线程共享资源 */
+/*
+ * 进程为资源分配的单位，保存线程共享资源
+ * 进程单独分配在堆上，由引用它的线程共同持有
+ */
 typedef struct {
     usize satp;         /* 页表寄存器 */
     File oFile[16];     /* 文件描述符 */
     uint8 fdOccupied[16];   /* 文件描述符是否被占用 */
+    int refCount;       /* 引用该进程的线程数 */
+    usize stackSlots;   /* 已被线程占用的用户栈槽位 */
+    usize cpuMask;      /* 运行过该进程的 hart，取消映射时只需要刷新这些 hart 的 TLB */
+    struct threadInfo *zombies; /* 已退出、尚未被等待的线程，由线程池的 lock 保护 */
 } Process;
 
 typedef struct {
     usize contextAddr;  /* 线程上下文存储的地址 */
     usize kstack;       /* 线程栈底地址 */
-    Process process;    /* 所属进程 */
+    Process *process;   /* 所属进程 */
     int wait;           /* 等待该线程退出的线程的 Tid */
+    int ustack;         /* 使用的用户栈槽位，内核线程为 -1 */
+    usize affinity;     /* 允许运行的 hart 掩码 */
+    FpContext *fp;      /* 浮点寄存器上下文，未使用过浮点时为 0 */
+    VecContext *vec;    /* 向量寄存器上下文，未使用过向量时为 0 */
 } Thread;
 
+#define ALL_HARTS       ((usize)-1)
+
+/*
+ * 线程离开 hart 不足 MIGRATION_COST 时认为其缓存仍然是热的
+ * 热线程只有在负载相差至少 MIGRATION_IMBALANCE 时才会被迁移
+ */
+#define MIGRATION_COST      US_TO_TIME(500)
+#define MIGRATION_IMBALANCE 2
+
 /* 线程状态 */
 typedef enum {
     Ready,
@@ -29,72 +51,137 @@ typedef enum {
     Exited
 } Status;
 
-/* 调度器算法实现 */
+/* 调度器算法实现，除 slice 外都作用于当前 hart 的调度器实例 */
 typedef struct {
     void    (* init)(void);
     void    (* push)(int);
     int     (* pop) (void);
     int     (* tick)(void);
     void    (* exit)(int);
+    usize   (* slice)(int, int);    /* 查询某个 hart 上线程当前的时间片长度 */
+    int     (* steal)(int, int (*)(int, void *), void *);   /* 从某个 hart 的队列中取出一个可以迁移的线程 */
 } Scheduler;
 
 /* 线程池中的线程信息槽 */
-typedef struct {
+typedef struct threadInfo {
     Status status;
     int tid;
     int occupied;       /* 该槽位是否被占用 */
     Thread thread;
+    struct threadInfo *nextFree;    /* 空闲槽位链表 */
+    /* 退出的用户线程保留槽位和退出码，直到被等待或进程结束 */
+    int zombie;
+    usize exitCode;
+    struct threadInfo *zombieNext;
+    /* 等待队列 */
+    Condvar *waitingOn;             /* 正在等待的条件变量 */
+    struct threadInfo *waitPrev;
+    struct threadInfo *waitNext;
+    Timer waitTimer;                /* 带超时的等待使用的时钟事件 */
+    int waitTimedOut;               /* 上一次等待是否超时 */
+    /* 多 hart 调度 */
+    int cpu;                        /* 线程所属的 hart，在该 hart 的调度器中排队 */
+    int onCpu;                      /* 线程是否正在某个 hart 上运行（尚未交还线程池） */
+    int wakePending;                /* 运行期间收到的唤醒，交还线程池时处理 */
+    int ipiQueued;                  /* 是否已在某个 hart 的邮箱中等待唤醒 */
+    struct threadInfo *ipiNext;     /* 邮箱中的唤醒链表 */
+    usize lastRan;                  /* 上一次离开 hart 的时间 */
 } ThreadInfo;
 
+/*
+ * 线程池，槽位按块动态扩展，线程数只受内核堆和物理内存的限制
+ * 所有 hart 共享同一个线程池，每个 hart 有各自的调度器实例
+ */
 typedef struct {
-    ThreadInfo threads[MAX_THREAD];
+    ThreadInfo **chunks;    /* 槽位块目录 */
+    int chunkCount;         /* 已分配的块数 */
+    int chunkCapacity;      /* 块目录容量 */
+    ThreadInfo *freeList;   /* 空闲槽位链表 */
     Scheduler scheduler;
+    int readyCount[NCPU];   /* 每个 hart 的调度器中等待运行的线程数 */
+    TicketLock lock;        /* 保护槽位的分配回收和线程状态 */
 } ThreadPool;
 
+/* 每个 hart 一个 Processor */
 typedef struct {
-    int tid;
-    Thread thread;
-} RunningThread;
-
-typedef struct {
-    ThreadPool pool;
     Thread idle;
-    RunningThread current;
+    ThreadInfo *current;    /* 正在运行的线程在线程池中的槽位 */
     int occupied;
+    int started;            /* 该 hart 是否已经启动 */
+    ThreadInfo *exited;     /* 刚刚退出、尚未回收的线程 */
+    int preemptCount;       /* 不为 0 时禁止抢占 */
+    int needResched;        /* 禁止抢占期间时间片用尽，等待计数归零后调度 */
 } Processor;
 
 /* 线程相关函数 */
 void switchThread(Thread *self, Thread *target);
+InterruptContext *userContext(Thread *thread);
 Thread newUserThread(char *data);
-int allocFd(Thread *thread);
-void deallocFd(Thread *thread, int fd);
+Thread newCloneThread(Process *process, int slot, usize entry, usize arg0, usize arg1);
+int allocUserStack(Process *process);
+void freeUserStack(Process *process, int slot);
+int allocFd(Process *process);
+void deallocFd(Process *process, int fd);
+
+/* 进程相关函数 */
+Process *newProcess(usize satp);
+void acquireProcess(Process *process);
+void releaseProcess(Process *process);
 
 /* 线程池相关函数 */
 ThreadPool newThreadPool(Scheduler scheduler);
-void addToPool(ThreadPool *pool, Thread thread);
-RunningThread acquireFromPool(ThreadPool *pool);
-void retrieveToPool(ThreadPool *pool, RunningThread rt);
+ThreadInfo *getThreadInfo(ThreadPool *pool, int tid);
+ThreadInfo *findInPool(ThreadPool *pool, int tid);
+int addToPool(ThreadPool *pool, Thread thread, int cpu);
+ThreadInfo *acquireFromPool(ThreadPool *pool);
+int retrieveToPool(ThreadPool *pool, ThreadInfo *ti);
 int tickPool(ThreadPool *pool);
-void exitFromPool(ThreadPool *pool, int tid);
+void wakeupInPool(ThreadPool *pool, int tid);
+int exitFromPool(ThreadPool *pool, int tid, usize code);
+void freeToPool(ThreadPool *pool, ThreadInfo *ti);
+ThreadInfo *findZombie(ThreadPool *pool, int tid);
+void reapZombie(ThreadPool *pool, ThreadInfo *ti);
+void reapZombies(ThreadPool *pool, Process *process);
+int stealFromPool(ThreadPool *pool);
+void dumpPool(ThreadPool *pool);
 
 /* Processor 相关函数 */
-void initCPU(Thread idle, ThreadPool pool);
-void addToCPU(Thread thread);
+void initCPU(ThreadPool pool);
+void initHartCPU(Thread idle);
+void startHarts();
+int addToCPU(Thread thread);
 void idleMain();
 void tickCPU();
+int needPreemptTick();
 void exitFromCPU(usize code);
 void runCPU();
 void yieldCPU();
 void wakeupCPU(int tid);
+void receiveWakeup(ThreadInfo *ti);
 int executeCPU(Inode *inode, int hostTid);
+int cloneCPU(usize entry, usize arg0, usize arg1);
+int joinCPU(int tid, usize *code);
+void reapZombiesCPU(Process *process);
+int setAffinityCPU(int tid, usize mask);
+usize getAffinityCPU(int tid);
+void dumpCPU();
 int getCurrentTid();
+ThreadInfo *getCurrentThreadInfo();
 Thread *getCurrentThread();
 
+/* 浮点和向量单元相关函数 */
+void initFpu();
+void switchFpu(Thread *self, Thread *target);
+int handleFpuTrap(InterruptContext *context, usize stval);
+void releaseFpu(Thread *thread);
+
 /* 调度器相关函数 */
 void schedulerInit();
 void schedulerPush(int tid);
 int  schedulerPop();
 int  schedulerTick();
 void schedulerExit(int tid);
+usize schedulerSlice(int cpu, int tid);
+int  schedulerSteal(int cpu, int (* movable)(int, void *), void *arg);
 
 #endif
\ No newline at end of file
@@ -4,85 +4,202 @@
  *  (C) 2021  Ziyang Guo
  */
 
+/*
+ * 线程池的槽位按块分配，每块 THREAD_CHUNK_SIZE 个槽位
+ * 块一经分配就不会移动，因此可以长期持有指向槽位的指针
+ * tid 的高位为块号，低位为块内下标
+ * 空闲槽位串成链表，分配和回收 tid 都是 O(1) 的
+ * 线程池由所有 hart 共享，槽位的分配回收和线程状态的修改都需要持有 lock
+ *
+ * 线程只在离开 hart 后才会迁移：唤醒时由 Processor 选择 hart，或被空闲的 hart 取走
+ * 刚离开 hart 不久的线程缓存仍然是热的，空闲 hart 不会取走这些线程
+ */
+
 #include "types.h"
 #include "def.h"
 #include "thread.h"
+#include "riscv.h"
 
 ThreadPool
 newThreadPool(Scheduler scheduler)
 {
     ThreadPool pool;
+    pool.chunks = 0;
+    pool.chunkCount = 0;
+    pool.chunkCapacity = 0;
+    pool.freeList = 0;
     pool.scheduler = scheduler;
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        pool.readyCount[i] = 0;
+    }
     return pool;
 }
 
-/* 在线程池中分配一个未被使用的 tid */
-int
-allocTid(ThreadPool *pool)
+/* 根据 tid 获取线程槽位 */
+ThreadInfo *
+getThreadInfo(ThreadPool *pool, int tid)
 {
-    int i;
-    for(i = 0; i < MAX_THREAD; i ++) {
-        if(!pool->threads[i].occupied) {
-            return i;
+    return &pool->chunks[tid >> THREAD_CHUNK_SHIFT][tid & (THREAD_CHUNK_SIZE - 1)];
+}
+
+/* 查找正在使用的线程槽位，tid 不存在时返回 0，调用者需要持有 lock */
+ThreadInfo *
+findInPool(ThreadPool *pool, int tid)
+{
+    if(tid < 0 || tid >= (pool->chunkCount << THREAD_CHUNK_SHIFT)) {
+        return 0;
+    }
+    ThreadInfo *ti = getThreadInfo(pool, tid);
+    return ti->occupied ? ti : 0;
+}
+
+/*
+ * 线程池扩展一块新的槽位，并全部加入空闲链表
+ * 块目录容量不足时倍增，只需拷贝块指针
+ * 堆空间不足时返回 -1
+ */
+static int
+growPool(ThreadPool *pool)
+{
+    if(pool->chunkCount == pool->chunkCapacity) {
+        int capacity = pool->chunkCapacity ? pool->chunkCapacity << 1 : 4;
+        ThreadInfo **chunks = tryKalloc(capacity * sizeof(ThreadInfo *));
+        if(chunks == 0) {
+            return -1;
+        }
+        int i;
+        for(i = 0; i < pool->chunkCount; i ++) {
+            chunks[i] = pool->chunks[i];
         }
+        kfree(pool->chunks);
+        pool->chunks = chunks;
+        pool->chunkCapacity = capacity;
+    }
+    ThreadInfo *chunk = tryKalloc(THREAD_CHUNK_SIZE * sizeof(ThreadInfo));
+    if(chunk == 0) {
+        return -1;
+    }
+    int base = pool->chunkCount << THREAD_CHUNK_SHIFT;
+    pool->chunks[pool->chunkCount ++] = chunk;
+    /* 倒序插入，使小的 tid 先被分配 */
+    int i;
+    for(i = THREAD_CHUNK_SIZE - 1; i >= 0; i --) {
+        chunk[i].tid = base + i;
+        chunk[i].nextFree = pool->freeList;
+        pool->freeList = &chunk[i];
     }
-    panic("Alloc tid failed!\n");
-    return -1;
+    return 0;
 }
 
-/* 将一个线程加入线程池，并参与调度 */
-void
-addToPool(ThreadPool *pool, Thread thread)
+/* 在线程池中分配一个未被使用的槽位，堆空间不足时返回 0 */
+static ThreadInfo *
+allocTid(ThreadPool *pool)
+{
+    if(!pool->freeList && growPool(pool) < 0) {
+        return 0;
+    }
+    ThreadInfo *ti = pool->freeList;
+    pool->freeList = ti->nextFree;
+    ti->nextFree = 0;
+    return ti;
+}
+
+/*
+ * 将一个线程加入线程池，返回分配的 tid，没有空间分配槽位时返回 -1
+ * 线程属于 cpu 号 hart，如果就是当前 hart 则直接参与调度
+ * 否则线程先处于休眠状态，由调用者通知目标 hart 将其唤醒
+ */
+int
+addToPool(ThreadPool *pool, Thread thread, int cpu)
 {
-    int tid = allocTid(pool);
-    pool->threads[tid].status = Ready;
-    pool->threads[tid].occupied = 1;
-    pool->threads[tid].thread = thread;
-    pool->scheduler.push(tid);
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    ThreadInfo *ti = allocTid(pool);
+    if(ti == 0) {
+        releaseTicketLockIrqrestore(&pool->lock, flags);
+        return -1;
+    }
+    ti->occupied = 1;
+    ti->zombie = 0;
+    ti->thread = thread;
+    ti->cpu = cpu;
+    ti->onCpu = 0;
+    ti->wakePending = 0;
+    ti->lastRan = 0;
+    if(cpu == cpuid()) {
+        ti->status = Ready;
+        pool->scheduler.push(ti->tid);
+        pool->readyCount[cpu] ++;
+    } else {
+        ti->status = Sleeping;
+    }
+    int tid = ti->tid;
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    return tid;
 }
 
 /*
- * 从线程池中获取一个可以运行的线程
- * 如果没有线程可运行则返回的 RunningThread 的 tid 为 -1
+ * 从当前 hart 的调度器中获取一个可以运行的线程
+ * 返回该线程在线程池中的槽位，线程在运行期间直接使用该槽位
+ * 如果没有线程可运行则返回 0
  */
-RunningThread
+ThreadInfo *
 acquireFromPool(ThreadPool *pool)
 {
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
     /*
      * 此处从 scheduler 中 pop 出一个可运行线程的 pid
      * 如果不再主动加入 scheduler，该线程本次运行后就不会再参与调度
      */
     int tid = pool->scheduler.pop();
-    RunningThread rt;
-    rt.tid = tid;
+    ThreadInfo *ti = 0;
     if(tid != -1) {
-        ThreadInfo *ti = &pool->threads[tid];
+        pool->readyCount[cpuid()] --;
+        ti = getThreadInfo(pool, tid);
         ti->status = Running;
-        ti->tid = tid;
-        rt.thread = ti->thread;
+        ti->onCpu = 1;
     }
-    return rt;
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    return ti;
 }
- 
-void
-retrieveToPool(ThreadPool *pool, RunningThread rt)
+
+/*
+ * 将正在运行的线程交还线程池
+ * 线程需要继续运行但已不允许在当前 hart 上运行时返回 1
+ * 此时线程处于休眠状态，由调用者将其唤醒到其他 hart
+ */
+int
+retrieveToPool(ThreadPool *pool, ThreadInfo *ti)
 {
-    int tid = rt.tid;
-    if(!pool->threads[tid].occupied) {
-        /* 表明刚刚这个线程退出了，回收栈空间 */
-        kfree((void *)pool->threads[tid].thread.kstack);
-        return;
+    if(!ti->occupied) {
+        /*
+         * 表明这个线程刚刚退出了
+         * 此时仍运行在它的内核栈上，槽位和栈空间由 Processor 在切换后回收
+         */
+        return 0;
     }
-    ThreadInfo *ti = &pool->threads[tid];
-    ti->thread = rt.thread;
+    int migrate = 0;
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    ti->onCpu = 0;
+    ti->lastRan = r_time();
     /*
      * 线程状态为 Running 表示上一个线程是因为时间片用尽而被打断，需要继续参与调度
      * 否则状态为 Sleeping，线程主动等待条件满足，无需参与调度
+     * 但如果在切换出去之前已经被唤醒，也需要继续参与调度
      */
-    if(ti->status == Running) {
-        ti->status = Ready;
-        pool->scheduler.push(tid);
+    if(ti->status == Running || ti->wakePending) {
+        if(ti->thread.affinity & (1UL << cpuid())) {
+            ti->status = Ready;
+            pool->scheduler.push(ti->tid);
+            pool->readyCount[cpuid()] ++;
+        } else {
+            ti->status = Sleeping;
+            migrate = 1;
+        }
     }
+    ti->wakePending = 0;
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    return migrate;
 }
 
 /* 查看当前线程是否需要切换 */
@@ -92,10 +209,200 @@ tickPool(ThreadPool *pool)
     return pool->scheduler.tick();
 }
 
-/* 线程退出，释放占据的线程池位置，并通知调度器 */
+/*
+ * 唤醒一个休眠的线程，使其加入当前 hart 的调度器
+ * 线程还在某个 hart 上运行（正要休眠）时只做标记，由 retrieveToPool 将其加入调度
+ * 线程已经就绪或正在运行时忽略
+ */
 void
-exitFromPool(ThreadPool *pool, int tid)
+wakeupInPool(ThreadPool *pool, int tid)
 {
-    pool->threads[tid].occupied = 0;
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    ThreadInfo *ti = getThreadInfo(pool, tid);
+    if(ti->occupied) {
+        if(ti->onCpu) {
+            ti->wakePending = 1;
+        } else if(ti->status == Sleeping) {
+            ti->status = Ready;
+            ti->cpu = cpuid();
+            pool->scheduler.push(tid);
+            pool->readyCount[ti->cpu] ++;
+        }
+    }
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+}
+
+/*
+ * 线程退出，并通知调度器
+ * 退出的线程在切换走之前仍会使用该槽位，切换之后再由 freeToPool 回收
+ * 用户线程成为僵尸线程，保留槽位和退出码，直到被同一进程中的线程等待或进程结束
+ * 返回等待该线程退出的线程 tid，没有则返回 -1
+ */
+int
+exitFromPool(ThreadPool *pool, int tid, usize code)
+{
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    ThreadInfo *ti = getThreadInfo(pool, tid);
+    ti->occupied = 0;
+    ti->status = Exited;
+    ti->exitCode = code;
+    if(ti->thread.ustack != -1) {
+        Process *process = ti->thread.process;
+        ti->zombie = 1;
+        ti->zombieNext = process->zombies;
+        process->zombies = ti;
+    }
+    int wait = ti->thread.wait;
     pool->scheduler.exit(tid);
-}
\ No newline at end of file
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    return wait;
+}
+
+/* 将槽位放回空闲链表，调用者需要持有 lock */
+static void
+releaseTid(ThreadPool *pool, ThreadInfo *ti)
+{
+    ti->thread.process = 0;
+    ti->nextFree = pool->freeList;
+    pool->freeList = ti;
+}
+
+/*
+ * 已退出的线程切换走之后，回收其槽位
+ * 僵尸线程的槽位保留到被等待或进程结束时，由 reapZombie 回收
+ */
+void
+freeToPool(ThreadPool *pool, ThreadInfo *ti)
+{
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    ti->onCpu = 0;
+    if(!ti->zombie) {
+        releaseTid(pool, ti);
+    }
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+}
+
+/* 查找尚未被回收的僵尸线程，tid 不存在时返回 0，调用者需要持有 lock */
+ThreadInfo *
+findZombie(ThreadPool *pool, int tid)
+{
+    if(tid < 0 || tid >= (pool->chunkCount << THREAD_CHUNK_SHIFT)) {
+        return 0;
+    }
+    ThreadInfo *ti = getThreadInfo(pool, tid);
+    return ti->zombie ? ti : 0;
+}
+
+/*
+ * 回收一个僵尸线程，调用者需要持有 lock
+ * 线程如果还没有从 hart 上切换走，槽位留给 freeToPool 回收
+ */
+void
+reapZombie(ThreadPool *pool, ThreadInfo *ti)
+{
+    ThreadInfo **p = &ti->thread.process->zombies;
+    while(*p != ti) {
+        p = &(*p)->zombieNext;
+    }
+    *p = ti->zombieNext;
+    ti->zombie = 0;
+    ti->zombieNext = 0;
+    if(!ti->onCpu) {
+        releaseTid(pool, ti);
+    }
+}
+
+/* 进程结束时回收其中所有的僵尸线程 */
+void
+reapZombies(ThreadPool *pool, Process *process)
+{
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    while(process->zombies) {
+        reapZombie(pool, process->zombies);
+    }
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+}
+
+/* 线程可以迁移到当前 hart：亲和性允许，且缓存已经冷却 */
+static int
+canMigrate(int tid, void *arg)
+{
+    ThreadInfo *ti = getThreadInfo((ThreadPool *)arg, tid);
+    return (ti->thread.affinity & (1UL << cpuid()))
+        && r_time() - ti->lastRan >= MIGRATION_COST;
+}
+
+/*
+ * 当前 hart 空闲时，从就绪线程最多的 hart 上取走一个线程
+ * 成功时线程加入当前 hart 的调度器，返回 1
+ */
+int
+stealFromPool(ThreadPool *pool)
+{
+    int self = cpuid();
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    int busiest = -1;
+    int i;
+    for(i = 0; i < NCPU; i ++) {
+        if(i != self && pool->readyCount[i] > 0
+            && (busiest == -1 || pool->readyCount[i] > pool->readyCount[busiest])) {
+            busiest = i;
+        }
+    }
+    int tid = -1;
+    if(busiest != -1) {
+        tid = pool->scheduler.steal(busiest, canMigrate, pool);
+    }
+    if(tid != -1) {
+        ThreadInfo *ti = getThreadInfo(pool, tid);
+        ti->cpu = self;
+        pool->readyCount[busiest] --;
+        pool->scheduler.push(tid);
+        pool->readyCount[self] ++;
+    }
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    return tid != -1;
+}
+
+/* dumpPool 输出的一行 */
+typedef struct {
+    int tid;
+    int cpu;
+    usize affinity;
+    Status status;
+    usize slice;
+} PoolRow;
+
+/*
+ * 输出线程池中所有线程所在的 hart、状态和时间片，用于调度参数调优
+ * 输出可能在串口发送缓冲区满时等待，因此先在锁内拷贝一份快照，释放锁之后再输出
+ */
+void
+dumpPool(ThreadPool *pool)
+{
+    static char *status[] = {"Ready", "Running", "Sleeping", "Exited"};
+    usize flags = acquireTicketLockIrqsave(&pool->lock);
+    int i, n = 0;
+    for(i = 0; i < pool->chunkCount << THREAD_CHUNK_SHIFT; i ++) {
+        n += getThreadInfo(pool, i)->occupied;
+    }
+    PoolRow *rows = tryKalloc(n * sizeof(PoolRow));
+    if(rows == 0) {
+        n = 0;
+    }
+    int count = 0;
+    for(i = 0; i < pool->chunkCount << THREAD_CHUNK_SHIFT && count < n; i ++) {
+        ThreadInfo *ti = getThreadInfo(pool, i);
+        if(ti->occupied) {
+            PoolRow row = {i, ti->cpu, ti->thread.affinity, ti->status, pool->scheduler.slice(ti->cpu, i)};
+            rows[count ++] = row;
+        }
+    }
+    releaseTicketLockIrqrestore(&pool->lock, flags);
+    printf("TID\tCPU\tAFFINITY\tSTATUS\t\tSLICE\n");
+    for(i = 0; i < count; i ++) {
+        printf("%d\t%d\t%p\t%s\t\t%d\n", rows[i].tid, rows[i].cpu, rows[i].affinity,
+            status[rows[i].status], (int)rows[i].slice);
+    }
+    kfree(rows);
+}
@@ -4,34 +4,427 @@
  *  (C) 2021  Ziyang Guo
  */
 
+/*
+ * timer.c 负责设置时钟中断
+ * 在 tickless 模式下，只有在确实有事件需要处理时才设置时钟中断：
+ *   抢占时钟只在运行线程之外还有就绪线程时才设置
+ *   CPU 空闲或只有一个可运行线程时，下一次中断由最早到期的时钟事件决定
+ * 时钟事件由分层时间轮管理，用于线程休眠和内核中的各种超时
+ * 多 hart 时各 hart 独立设置自己的抢占时钟
+ * 时间轮为所有 hart 共享，只由 timekeeper（启动 hart）处理到期事件
+ * 支持 Sstc 扩展的 hart 直接写 stimecmp 设置时钟，否则通过 SBI 调用设置
+ */
+
 #include "types.h"
 #include "def.h"
 #include "riscv.h"
+#include "context.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "ipi.h"
 
 static const usize INTERVAL = 100000;   /* 时钟中断间隔 */
+static const int TICKLESS = 1;          /* 是否启用 tickless 模式 */
 
-void setTimeout();
+static usize tickDeadline[NCPU];    /* 下一次抢占时钟的时间，0 表示未设置 */
+static usize programmed[NCPU];      /* 当前设置的硬件时钟时间，0 表示需要重新设置 */
+static int timekeeper;              /* 负责处理时间轮的 hart */
+static int hasSstc[NCPU];           /* hart 是否支持 Sstc 扩展 */
+static volatile int probing[NCPU];  /* hart 是否正在探测 Sstc 扩展 */
+
+/*
+ * 时间轮的实现
+ *
+ * 时间以粒度（GRANULE_SHIFT 位 time 计数）为单位，共 WHEEL_LEVELS 层，每层 WHEEL_SIZE 个槽
+ * 第 n 层的每个槽覆盖 WHEEL_SIZE^n 个粒度，距到期越远的事件放在越高的层
+ * 低层转完一圈时，将高层对应槽中的事件重新分配到低层（cascade）
+ * 每层用一个位图记录非空的槽，插入、删除和查找最早事件都是 O(1) 的
+ */
+
+#define GRANULE_SHIFT   10          /* 每个粒度 1024 个 time 计数，约 100 微秒 */
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+
+static struct {
+    Timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    usize pending[WHEEL_LEVELS];    /* 每层非空槽的位图 */
+    usize next;                     /* 下一个需要处理的粒度 */
+    Timer *running;                 /* 正在执行回调的事件 */
+    Spinlock lock;
+} wheel;
+
+/* 最低位 1 的位置，x 不能为 0 */
+static int
+lowestBit(usize x)
+{
+    static const uint8 table[64] = {
+        0,  1,  2, 53,  3,  7, 54, 27,  4, 38, 41,  8, 34, 55, 48, 28,
+        62,  5, 39, 46, 44, 42, 22,  9, 24, 35, 59, 56, 49, 18, 29, 11,
+        63, 52,  6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+        51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+    };
+    return table[((x & -x) * 0x022FDD63CC95386DUL) >> 58];
+}
 
+/* 循环右移 */
+static usize
+rotateRight(usize x, int n)
+{
+    return (x >> n) | (x << ((WHEEL_SIZE - n) & WHEEL_MASK));
+}
+
+/* 根据到期时间将事件放入对应的层和槽 */
+static void
+enqueueTimer(Timer *t)
+{
+    usize expires = t->expires;
+    usize delta = expires - wheel.next;
+    int level = 0;
+    if((long)delta < 0) {
+        /* 已经过期，放入下一个处理的槽 */
+        expires = wheel.next;
+    } else {
+        while(level < WHEEL_LEVELS - 1 && delta >= (1UL << (WHEEL_BITS * (level + 1)))) {
+            level ++;
+        }
+        if(delta >= (1UL << (WHEEL_BITS * WHEEL_LEVELS))) {
+            /* 超出时间轮范围，先放在最高层最远处，cascade 时重新计算 */
+            expires = wheel.next + (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+        }
+    }
+    int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    Timer **head = &wheel.slots[level][slot];
+    t->level = level;
+    t->slot = slot;
+    t->next = *head;
+    if(*head) {
+        (*head)->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    wheel.pending[level] |= (1UL << slot);
+}
+
+static void
+dequeueTimer(Timer *t)
+{
+    *t->pprev = t->next;
+    if(t->next) {
+        t->next->pprev = t->pprev;
+    }
+    if(!wheel.slots[t->level][t->slot]) {
+        wheel.pending[t->level] &= ~(1UL << t->slot);
+    }
+}
+
+/*
+ * 时间轮为空时将 wheel.next 推进到当前时刻
+ * 长时间空闲后 wheel.next 已经过时，新事件不必从过时的起点计算，下一次时钟中断也不必逐粒度追赶
+ * 回调执行期间 runWheel 仍在推进 wheel.next，此时不能修改
+ */
+static void
+forwardWheel()
+{
+    int level;
+    if(wheel.running) {
+        return;
+    }
+    for(level = 0; level < WHEEL_LEVELS; level ++) {
+        if(wheel.pending[level]) {
+            return;
+        }
+    }
+    usize now = r_time() >> GRANULE_SHIFT;
+    if((long)(now - wheel.next) > 0) {
+        wheel.next = now;
+    }
+}
+
+/* 取出一个槽中的所有事件 */
+static Timer *
+detachSlot(int level, int slot)
+{
+    Timer *list = wheel.slots[level][slot];
+    wheel.slots[level][slot] = 0;
+    wheel.pending[level] &= ~(1UL << slot);
+    return list;
+}
+
+/* 将高层的一个槽重新分配到低层，返回该槽的下标 */
+static int
+cascade(int level, int slot)
+{
+    Timer *t = detachSlot(level, slot);
+    while(t) {
+        Timer *next = t->next;
+        enqueueTimer(t);
+        t = next;
+    }
+    return slot;
+}
+
+/*
+ * 处理所有到期时间不晚于 now 粒度的事件，调用前需持有 wheel.lock
+ * 回调执行期间释放锁并恢复中断状态 flags，回调中可以添加或取消时钟事件
+ */
+static void
+runWheel(usize now, usize flags)
+{
+    while((long)(wheel.next - now) <= 0) {
+        int index = wheel.next & WHEEL_MASK;
+        if(index == 0) {
+            int level = 1;
+            while(level < WHEEL_LEVELS
+                && cascade(level, (wheel.next >> (WHEEL_BITS * level)) & WHEEL_MASK) == 0) {
+                level ++;
+            }
+        }
+        /* 每次只取一个事件，释放锁期间槽中的事件可能被取消 */
+        Timer *t;
+        while((t = wheel.slots[0][index])) {
+            dequeueTimer(t);
+            t->pending = 0;
+            void (* callback)(usize) = t->callback;
+            usize arg = t->arg;
+            wheel.running = t;
+            releaseSpinlockIrqrestore(&wheel.lock, flags);
+            callback(arg);
+            flags = acquireSpinlockIrqsave(&wheel.lock);
+            wheel.running = 0;
+        }
+        wheel.next ++;
+        /* 跳过本圈中剩余的空槽，长时间空闲后不必逐个粒度推进 */
+        index = wheel.next & WHEEL_MASK;
+        if(index != 0) {
+            usize rest = wheel.pending[0] >> index;
+            usize jump = rest ? wheel.next + lowestBit(rest) : (wheel.next | WHEEL_MASK) + 1;
+            wheel.next = (long)(jump - now) > 0 ? now + 1 : jump;
+        }
+    }
+}
+
+/* 最早需要处理的时间粒度，没有时钟事件时返回 -1 */
+static usize
+earliestExpiry()
+{
+    usize best = -1;
+    int level;
+    for(level = 0; level < WHEEL_LEVELS; level ++) {
+        usize bits = wheel.pending[level];
+        if(!bits) {
+            continue;
+        }
+        int shift = WHEEL_BITS * level;
+        int index = (wheel.next >> shift) & WHEEL_MASK;
+        usize g;
+        if(level == 0) {
+            g = wheel.next + lowestBit(rotateRight(bits, index));
+        } else if((wheel.next & ((1UL << shift) - 1)) == 0 && (bits & (1UL << index))) {
+            /* 恰好处于该层的边界，当前下标的槽还没有 cascade */
+            g = wheel.next;
+        } else {
+            /* 高层当前下标的槽已经 cascade 过，其中的事件属于下一圈 */
+            usize offset = lowestBit(rotateRight(bits, (index + 1) & WHEEL_MASK)) + 1;
+            g = ((wheel.next >> shift) + offset) << shift;
+        }
+        if(g < best) {
+            best = g;
+        }
+    }
+    return best;
+}
+
+/*
+ * 探测 Sstc 扩展时的非法指令异常，由 handleInterrupt 调用
+ * 不支持 Sstc 或 M-Mode 未开放 stimecmp 时读取会触发异常，跳过该指令并记录
+ * 是探测引起的异常返回 1
+ */
+int
+handleSstcProbe(InterruptContext *context)
+{
+    int cpu = cpuid();
+    if(!probing[cpu] || !(context->sstatus & SSTATUS_SPP)) {
+        return 0;
+    }
+    probing[cpu] = 0;
+    context->sepc += 4;
+    return 1;
+}
+
+/* 尝试读取 stimecmp，没有触发异常说明支持 Sstc */
+static void
+probeSstc()
+{
+    usize flags = disable_and_store();
+    int cpu = cpuid();
+    probing[cpu] = 1;
+    r_stimecmp();
+    hasSstc[cpu] = probing[cpu];
+    probing[cpu] = 0;
+    restore_sstatus(flags);
+}
+
+/* 每个 hart 的时钟初始化 */
 void
-initTimer()
+initHartTimer()
 {
+    probeSstc();
     /* 时钟中断使能 */
     w_sie(r_sie() | SIE_STIE);
     /* 允许 S-Mode 线程被中断打断 */
     w_sstatus(r_sstatus() | SSTATUS_SIE);
     /* 初始化第一次时钟中断 */
-    setTimeout();
+    updateTimer();
+}
+
+void
+initTimer()
+{
+    timekeeper = cpuid();
+    initSpinlock(&wheel.lock, "timer");
+    wheel.next = r_time() >> GRANULE_SHIFT;
+    initHartTimer();
+}
+
+/* 设置当前 hart 的硬件时钟，time 为 -1 时不再产生时钟中断 */
+static void
+setTimeout(usize time)
+{
+    int cpu = cpuid();
+    if(time != programmed[cpu]) {
+        programmed[cpu] = time;
+        if(hasSstc[cpu]) {
+            w_stimecmp(time);
+        } else {
+            setTimer(time);
+        }
+    }
+}
+
+/*
+ * 根据当前的调度状态和时钟事件重新设置下一次时钟中断
+ * 调度状态改变（线程切换、唤醒、进入空闲）后都应当调用
+ */
+void
+updateTimer()
+{
+    usize flags = disable_and_store();
+    int cpu = cpuid();
+    extern int needPreemptTick();
+    if(!TICKLESS || needPreemptTick()) {
+        if(tickDeadline[cpu] == 0) {
+            tickDeadline[cpu] = r_time() + INTERVAL;
+        }
+    } else {
+        /* 空闲或只有一个可运行线程，停止抢占时钟 */
+        tickDeadline[cpu] = 0;
+    }
+    usize next = tickDeadline[cpu] ? tickDeadline[cpu] : -1;
+    if(cpu == timekeeper) {
+        acquireSpinlock(&wheel.lock);
+        usize expiry = earliestExpiry();
+        releaseSpinlock(&wheel.lock);
+        if(expiry != -1 && (expiry << GRANULE_SHIFT) < next) {
+            next = expiry << GRANULE_SHIFT;
+        }
+    }
+    setTimeout(next);
+    restore_sstatus(flags);
+}
+
+/*
+ * 添加一个在 deadline 时刻到期的时钟事件
+ * 最早到期时间提前时，需要通知 timekeeper 重新设置时钟
+ */
+void
+addTimer(Timer *t, usize deadline, void (* callback)(usize), usize arg)
+{
+    usize flags = acquireSpinlockIrqsave(&wheel.lock);
+    if(t->pending) {
+        dequeueTimer(t);
+    }
+    forwardWheel();
+    usize before = earliestExpiry();
+    t->deadline = deadline;
+    t->expires = (deadline + (1UL << GRANULE_SHIFT) - 1) >> GRANULE_SHIFT;
+    t->callback = callback;
+    t->arg = arg;
+    t->pending = 1;
+    enqueueTimer(t);
+    int earlier = earliestExpiry() != before;
+    releaseSpinlock(&wheel.lock);
+    if(cpuid() == timekeeper) {
+        updateTimer();
+    } else if(earlier) {
+        postIpi(timekeeper, IPI_TIMER);
+    }
+    restore_sstatus(flags);
 }
 
+/*
+ * 取消一个尚未到期的时钟事件
+ * 如果回调正在 timekeeper 上执行，等待其执行完成，返回后事件不再被引用
+ */
 void
-setTimeout()
+cancelTimer(Timer *t)
+{
+    usize flags = acquireSpinlockIrqsave(&wheel.lock);
+    if(t->pending) {
+        dequeueTimer(t);
+        t->pending = 0;
+    }
+    releaseSpinlock(&wheel.lock);
+    while(__atomic_load_n(&wheel.running, __ATOMIC_ACQUIRE) == t) {}
+    restore_sstatus(flags);
+}
+
+static void
+wakeupSleeper(usize tid)
 {
-    /* 设置下一次时钟时间为当前时间 + INTERVAL */
-    setTimer(r_time() + INTERVAL);
+    extern void wakeupCPU(int tid); wakeupCPU(tid);
 }
 
+/*
+ * 当前线程休眠到 deadline 时刻
+ * 线程可能被其他原因提前唤醒，未到 deadline 时重新设置时钟继续休眠
+ */
 void
+sleepUntil(usize deadline)
+{
+    usize flags = disable_and_store();
+    extern int getCurrentTid();
+    extern void yieldCPU();
+    while(r_time() < deadline) {
+        Timer t;
+        t.pending = 0;
+        addTimer(&t, deadline, wakeupSleeper, getCurrentTid());
+        yieldCPU();
+        cancelTimer(&t);
+    }
+    restore_sstatus(flags);
+}
+
+/*
+ * 时钟软中断中调用
+ * 触发所有到期的时钟事件，并返回抢占时钟是否到期
+ */
+int
 tick()
 {
-    setTimeout();
-}
\ No newline at end of file
+    usize now = r_time();
+    int cpu = cpuid();
+    /* 已设置的时钟已经触发，之后必须重新设置 */
+    programmed[cpu] = 0;
+    if(cpu == timekeeper) {
+        usize flags = acquireSpinlockIrqsave(&wheel.lock);
+        runWheel(now >> GRANULE_SHIFT, flags);
+        releaseSpinlockIrqrestore(&wheel.lock, flags);
+    }
+    if(tickDeadline[cpu] && tickDeadline[cpu] <= now) {
+        tickDeadline[cpu] = 0;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+
+/*
+ * 时钟事件
+ * 到期时在时钟中断中调用 callback(arg)
+ * 结构体由使用者提供，时钟模块不负责分配和回收
+ */
+typedef struct timer {
+    usize deadline;                 /* 到期时间 */
+    usize expires;                  /* 到期的时间粒度，由 deadline 向上取整 */
+    void (* callback)(usize);       /* 到期时执行的回调 */
+    usize arg;                      /* 回调参数 */
+    int pending;                    /* 是否正在等待到期 */
+    int level;                      /* 所在时间轮的层 */
+    int slot;                       /* 所在时间轮的槽 */
+    struct timer *next;
+    struct timer **pprev;           /* 指向前一个节点的 next，便于 O(1) 删除 */
+} Timer;
+
+/* 与 Linux 相同的时间结构，用于 nanosleep */
+typedef struct {
+    usize sec;
+    usize nsec;
+} TimeSpec;
+
+void addTimer(Timer *t, usize deadline, void (* callback)(usize), usize arg);
+void cancelTimer(Timer *t);
+void updateTimer();
+void sleepUntil(usize deadline);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *  kernel/tty.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * tty.c 实现了终端的规范模式行规程
+ *
+ * 串口收到的字符先进入行编辑缓冲区，由内核负责回显、退格和 Ctrl-C
+ * 收到换行后整行提交到标准输入缓冲区，读取者每次最多得到一行
+ * 一次串口中断收到的所有字符处理完成后才唤醒读取者
+ * 行编辑缓冲区只在串口软中断中访问，串口中断只发送给启动 hart，不需要加锁
+ */
+
+#include "types.h"
+#include "def.h"
+#include "stdin.h"
+
+#define LF          0x0a
+#define CR          0x0d
+#define BS          0x08
+#define DL          0x7f
+#define CTRLC       0x03
+
+#define TTY_LINE_MAX    256     /* 一行的最大长度，包括换行符 */
+
+static char line[TTY_LINE_MAX];
+static int lineLen;
+
+/*
+ * 将编辑中的行整体提交到标准输入缓冲区，剩余空间放不下整行时丢弃该行
+ * 此时不唤醒读取者，由 ttyFlush 统一唤醒
+ */
+static void
+commitLine()
+{
+    pushChars(line, lineLen);
+    lineLen = 0;
+}
+
+/*
+ * 处理一个收到的字符，在串口软中断中调用
+ * 回车和换行结束一行，退格删除最后一个字符，Ctrl-C 丢弃当前行并提交一个空行
+ * 行满时只接受换行、退格和 Ctrl-C
+ */
+void
+ttyInput(char c)
+{
+    switch(c) {
+    case CR:
+    case LF:
+        line[lineLen ++] = '\n';
+        uartPutc('\n');
+        commitLine();
+        break;
+    case BS:
+    case DL:
+        if(lineLen > 0) {
+            lineLen --;
+            uartWrite("\b \b", 3);
+        }
+        break;
+    case CTRLC:
+        lineLen = 0;
+        uartWrite("^C\n", 3);
+        line[lineLen ++] = '\n';
+        commitLine();
+        break;
+    default:
+        if(lineLen < TTY_LINE_MAX - 1) {
+            line[lineLen ++] = c;
+            uartPutc(c);
+        }
+        break;
+    }
+}
+
+/* 一批输入处理完成后调用，唤醒等待的读取者 */
+void
+ttyFlush()
+{
+    wakeStdin();
+}
+
+/*
+ * 从终端读取最多 len 个字节
+ * 没有完整的行时等待，每次最多返回一行，返回读取的字节数
+ */
+usize
+ttyRead(char *buf, usize len)
+{
+    if(len == 0) {
+        return 0;
+    }
+    return popChars(buf, len);
+}
@@ -0,0 +1,194 @@
+/*
+ *  kernel/uart.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * uart.c 是 16550 串口的驱动，直接读写 MMIO 寄存器，不再经过 SBI
+ *
+ * 输出的字符先放入发送环形缓冲区，发送保持寄存器空时尽量填满发送 FIFO
+ * 缓冲区中还有字符时打开发送空中断，由中断继续发送，缓冲区满时直接轮询发送
+ * 接收中断一次取空接收 FIFO，字符放入接收环形缓冲区后由串口软中断交给终端行规程
+ * 串口初始化之前的输出仍然通过 SBI 完成，整段字符串一次交给 SBI
+ */
+
+#include "types.h"
+#include "def.h"
+#include "consts.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "plic.h"
+#include "softirq.h"
+
+/* QEMU virt 平台的串口物理地址 */
+#define UART0               0x10000000
+
+/* 16550 寄存器 */
+#define UART(reg)           (*(volatile uint8 *)(UART0 + KERNEL_MAP_OFFSET + (reg)))
+#define RHR                 0       /* 接收保持寄存器（读） */
+#define THR                 0       /* 发送保持寄存器（写） */
+#define IER                 1       /* 中断使能寄存器 */
+#define IER_RX_ENABLE       (1 << 0)
+#define IER_TX_ENABLE       (1 << 1)
+#define FCR                 2       /* FIFO 控制寄存器（写） */
+#define FCR_FIFO_ENABLE     (1 << 0)
+#define FCR_FIFO_CLEAR      (3 << 1)
+#define ISR                 2       /* 中断状态寄存器（读） */
+#define LCR                 3       /* 线路控制寄存器 */
+#define LCR_EIGHT_BITS      (3 << 0)
+#define MCR                 4       /* 调制解调器控制寄存器 */
+#define MCR_DTR_RTS_OUT2    0x0b    /* OUT2 打开后串口中断才会送到 PLIC */
+#define LSR                 5       /* 线路状态寄存器 */
+#define LSR_RX_READY        (1 << 0)
+#define LSR_TX_IDLE         (1 << 5)
+
+#define UART_FIFO_SIZE      16      /* 发送 FIFO 的深度 */
+
+/* 发送环形缓冲区，由 txLock 保护 */
+#define UART_TX_SIZE        1024
+static char txBuf[UART_TX_SIZE];
+static uint32 txHead, txTail;
+static Spinlock txLock;
+
+/*
+ * 接收环形缓冲区
+ * 只有启动 hart 接收串口中断，中断写入 head，软中断读取 tail
+ * 缓冲区满时丢弃新收到的字符
+ */
+#define UART_RX_SIZE        256
+static char rxBuf[UART_RX_SIZE];
+static uint32 rxHead, rxTail;
+
+static int uartReady;           /* 串口是否已经初始化 */
+
+/*
+ * 发送保持寄存器空时，将缓冲区中的字符填入发送 FIFO
+ * 缓冲区中还有字符时打开发送空中断，否则关闭，调用前需持有 txLock
+ */
+static void
+uartStart()
+{
+    if(UART(LSR) & LSR_TX_IDLE) {
+        int n = 0;
+        while(txTail != txHead && n < UART_FIFO_SIZE) {
+            UART(THR) = txBuf[txTail % UART_TX_SIZE];
+            txTail ++;
+            n ++;
+        }
+    }
+    if(txTail != txHead) {
+        UART(IER) = IER_RX_ENABLE | IER_TX_ENABLE;
+    } else {
+        UART(IER) = IER_RX_ENABLE;
+    }
+}
+
+/* 轮询发送一个缓冲区中的字符，调用前需持有 txLock */
+static void
+uartSpin()
+{
+    while(!(UART(LSR) & LSR_TX_IDLE)) {}
+    UART(THR) = txBuf[txTail % UART_TX_SIZE];
+    txTail ++;
+}
+
+/*
+ * 输出一段字符串，整段放入缓冲区后再开始发送
+ * 缓冲区满时轮询发送最早的字符，可以在中断和关闭中断的情况下调用
+ */
+void
+uartWrite(char *buf, usize len)
+{
+    if(!uartReady) {
+        consoleWrite(buf, len);
+        return;
+    }
+    usize flags = acquireSpinlockIrqsave(&txLock);
+    usize i;
+    for(i = 0; i < len; i ++) {
+        if(txHead - txTail == UART_TX_SIZE) {
+            uartSpin();
+        }
+        txBuf[txHead % UART_TX_SIZE] = buf[i];
+        txHead ++;
+    }
+    uartStart();
+    releaseSpinlockIrqrestore(&txLock, flags);
+}
+
+/* 输出一个字符 */
+void
+uartPutc(char c)
+{
+    uartWrite(&c, 1);
+}
+
+/*
+ * 轮询发送缓冲区中所有的字符
+ * 只在 panic 时调用，此时可能持有 txLock，因此不获取锁
+ */
+void
+uartFlush()
+{
+    if(!uartReady) {
+        return;
+    }
+    while(txTail != txHead) {
+        uartSpin();
+    }
+}
+
+/* 串口中断，取空接收 FIFO，并继续发送缓冲区中的字符 */
+static void
+uartInterrupt(int irq)
+{
+    int received = 0;
+    while(UART(LSR) & LSR_RX_READY) {
+        char c = UART(RHR);
+        uint32 head = rxHead;
+        if(head - __atomic_load_n(&rxTail, __ATOMIC_ACQUIRE) < UART_RX_SIZE) {
+            rxBuf[head % UART_RX_SIZE] = c;
+            __atomic_store_n(&rxHead, head + 1, __ATOMIC_RELEASE);
+        }
+        received = 1;
+    }
+    if(received) {
+        raiseSoftirq(SOFTIRQ_SERIAL);
+    }
+    acquireSpinlock(&txLock);
+    uartStart();
+    releaseSpinlock(&txLock);
+}
+
+/* 串口软中断，所有收到的字符都交给终端行规程处理 */
+static void
+uartSoftirq()
+{
+    uint32 tail = rxTail;
+    while(tail != __atomic_load_n(&rxHead, __ATOMIC_ACQUIRE)) {
+        extern void ttyInput(char c); ttyInput(rxBuf[tail % UART_RX_SIZE]);
+        tail ++;
+        __atomic_store_n(&rxTail, tail, __ATOMIC_RELEASE);
+    }
+    extern void ttyFlush(); ttyFlush();
+}
+
+/*
+ * 初始化串口
+ * 8 位数据位，打开并清空 FIFO，打开接收中断，并在 PLIC 中注册
+ * OpenSBI 已经设置好了波特率
+ */
+void
+initUart()
+{
+    initSpinlock(&txLock, "uart");
+    UART(IER) = 0;
+    UART(LCR) = LCR_EIGHT_BITS;
+    UART(FCR) = FCR_FIFO_ENABLE | FCR_FIFO_CLEAR;
+    UART(MCR) = MCR_DTR_RTS_OUT2;
+    UART(IER) = IER_RX_ENABLE;
+    openSoftirq(SOFTIRQ_SERIAL, uartSoftirq);
+    registerIrq(UART0_IRQ, 1, uartInterrupt);
+    uartReady = 1;
+}
@@ -23,13 +23,56 @@ uint8 getc()
     return c;
 }
 
+/*
+ * 从文件 fd 读取最多 len 个字节，返回读取的字节数，出错返回 -1
+ * 终端处于规范模式，每次最多读取一行
+ */
+int read(int fd, void *buf, uint64 len)
+{
+    return sys_read(fd, buf, len);
+}
+
+/* 向文件 fd 写入 len 个字节，返回写入的字节数，出错返回 -1 */
+int write(int fd, void *buf, uint64 len)
+{
+    return sys_write(fd, buf, len);
+}
+
 void putchar(int c)
 {
-    sys_write(c);
+    char ch = c;
+    sys_write(1, &ch, 1);
+}
+
+/*
+ * 输出缓冲区，每次 printf 的输出先放入缓冲区，结束时通过一次系统调用输出
+ * 缓冲区满时提前输出
+ */
+#define PRINT_BUF_SIZE 128
+
+typedef struct {
+    char buf[PRINT_BUF_SIZE];
+    int len;
+} PrintBuf;
+
+static void
+flush(PrintBuf *pb)
+{
+    if (pb->len > 0)
+        sys_write(1, pb->buf, pb->len);
+    pb->len = 0;
+}
+
+static void
+putc(PrintBuf *pb, char c)
+{
+    pb->buf[pb->len++] = c;
+    if (pb->len == PRINT_BUF_SIZE)
+        flush(pb);
 }
 
 static void
-printint(int xx, int base, int sign)
+printint(PrintBuf *pb, int xx, int base, int sign)
 {
     char buf[16];
     int i;
@@ -50,17 +93,17 @@ printint(int xx, int base, int sign)
         buf[i++] = '-';
 
     while (--i >= 0)
-        putchar(buf[i]);
+        putc(pb, buf[i]);
 }
 
 static void
-printptr(uint64 x)
+printptr(PrintBuf *pb, uint64 x)
 {
     int i;
-    putchar('0');
-    putchar('x');
+    putc(pb, '0');
+    putc(pb, 'x');
     for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-        putchar(digits[x >> (sizeof(uint64) * 8 - 4)]);
+        putc(pb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 void printf(char *fmt, ...)
@@ -68,16 +111,18 @@ void printf(char *fmt, ...)
     va_list ap;
     int i, c;
     char *s;
+    PrintBuf pb;
 
     if (fmt == 0)
         panic("null fmt");
 
+    pb.len = 0;
     va_start(ap, fmt);
     for (i = 0; (c = fmt[i] & 0xff) != 0; i++)
     {
         if (c != '%')
         {
-            putchar(c);
+            putc(&pb, c);
             continue;
         }
         c = fmt[++i] & 0xff;
@@ -86,29 +131,31 @@ void printf(char *fmt, ...)
         switch (c)
         {
         case 'd':
-            printint(va_arg(ap, int), 10, 1);
+            printint(&pb, va_arg(ap, int), 10, 1);
             break;
         case 'x':
-            printint(va_arg(ap, int), 16, 1);
+            printint(&pb, va_arg(ap, int), 16, 1);
             break;
         case 'p':
-            printptr(va_arg(ap, uint64));
+            printptr(&pb, va_arg(ap, uint64));
             break;
         case 's':
             if ((s = va_arg(ap, char *)) == 0)
                 s = "(null)";
             for (; *s; s++)
-                putchar(*s);
+                putc(&pb, *s);
             break;
         case '%':
-            putchar('%');
+            putc(&pb, '%');
             break;
         default:
-            putchar('%');
-            putchar(c);
+            putc(&pb, '%');
+            putc(&pb, c);
             break;
         }
     }
+    va_end(ap);
+    flush(&pb);
 }
 
 void panic(char *s)
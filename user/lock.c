@@ -0,0 +1,72 @@
+/*
+ *  user/lock.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * lock.c 定义了 U-Mode 下的互斥锁和条件变量
+ * 无竞争时只使用原子指令，不会陷入内核
+ * 发生竞争时通过 futex 系统调用休眠和唤醒
+ */
+
+#include "types.h"
+#include "ulib.h"
+#include "syscall.h"
+
+/*
+ * 互斥锁的 state：
+ * 0 表示未上锁，1 表示上锁且无等待者，2 表示上锁且可能有等待者
+ */
+void
+mutex_lock(Mutex *m)
+{
+    uint32 c = 0;
+    if(__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if(c != 2) {
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while(c != 0) {
+        sys_futex_wait(&m->state, 2, 0);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void
+mutex_unlock(Mutex *m)
+{
+    if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        /* 可能有等待者 */
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        sys_futex_wake(&m->state, 1);
+    }
+}
+
+/*
+ * 条件变量的 seq 在每次通知时加一
+ * 等待者记录释放锁之前的 seq，只要期间有过通知就不会休眠
+ */
+void
+cond_wait(Cond *c, Mutex *m)
+{
+    uint32 seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    mutex_unlock(m);
+    sys_futex_wait(&c->seq, seq, 0);
+    mutex_lock(m);
+}
+
+void
+cond_signal(Cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    sys_futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(Cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    sys_futex_wake(&c->seq, 0x7fffffff);
+}
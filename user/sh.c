@@ -9,10 +9,6 @@
 #include "syscall.h"
 
 #define LF      0x0au
-#define CR      0x0du
-#define BS      0x08u
-#define DL      0x7fu
-#define CTRLC   0x03u
 
 int
 isEmpty(char *line, int length) {
@@ -64,56 +60,43 @@ isBuildIn(char *line, int fd) {
         sys_pwd(fd);
         return 1;
     }
+    if(len >= 2 && line[0] == 'p' && line[1] == 's' && (line[2] == ' ' || line[2] == '\t' || line[2] == '\0')) {
+        sys_ps();
+        return 1;
+    }
+    if(!strcmp("lockstat", line)) {
+        sys_lockstat();
+        return 1;
+    }
     return 0;
 }
 
+/*
+ * 终端的行编辑（回显、退格和 Ctrl-C）由内核完成
+ * 每次读取得到完整的一行，Ctrl-C 得到一个空行
+ */
 uint64
 main()
 {
     char line[256];
-    int lineCount = 0;
     int fd = sys_open("/");
     printf("Welcome to Moonix!\n");
-    printf("$ ");
     while(1) {
-        uint8 c = getc();
-        switch(c) {
-            case LF: case CR: 
-                printf("\n");
-                if(!isEmpty(line, 256)) {
-                    char *stripLine = line;
-                    while(*stripLine == ' ' || *stripLine == '\t') stripLine ++;
-                    if(!isBuildIn(stripLine, fd)) {
-                        sys_exec(stripLine, fd);
-                    }
-                    lineCount = 0;
-                    empty(line, 256);
-                }
-                printf("$ ");
-                break;
-            case CTRLC:
-                printf("\n");
-                lineCount = 0;
-                empty(line, 256);
-                printf("$ ");
-                break;
-            /* 支持退格键 */
-            case DL:
-                if(lineCount > 0) {
-                    putchar(BS);
-                    putchar(' ');
-                    putchar(BS);
-                    line[lineCount-1] = 0;
-                    lineCount -= 1;
-                }
-                break;
-            default:
-                if(lineCount < 255) {
-                    line[lineCount] = c;
-                    lineCount += 1;
-                    putchar(c);
-                }
-                break;
+        printf("$ ");
+        empty(line, 256);
+        int n = read(0, line, 255);
+        if(n <= 0) {
+            continue;
+        }
+        if(line[n - 1] == LF) {
+            line[n - 1] = 0;
+        }
+        if(!isEmpty(line, 256)) {
+            char *stripLine = line;
+            while(*stripLine == ' ' || *stripLine == '\t') stripLine ++;
+            if(!isBuildIn(stripLine, fd)) {
+                sys_exec(stripLine, fd);
+            }
         }
     }
-}
\ No newline at end of file
+}
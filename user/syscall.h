@@ -6,11 +6,20 @@ typedef enum {
     LsDir = 20,
     CdDir = 21,
     Pwd = 22,
+    Ps = 23,
+    Join = 24,
+    FutexWait = 25,
+    FutexWake = 26,
+    LockStat = 27,
     Open = 56,
     Close = 57,
     Read = 63,
     Write = 64,
     Exit = 93,
+    Nanosleep = 101,
+    SchedSetaffinity = 122,
+    SchedGetaffinity = 123,
+    Clone = 220,
     Exec = 221,
 } SyscallId;
 
@@ -22,9 +31,10 @@ typedef enum {
     register unsigned long a3 asm("a3") = (unsigned long)(__a3);    \
     register unsigned long a7 asm("a7") = (unsigned long)(__num);   \
     asm volatile("ecall"                                            \
-                : "+r"(a0)                                          \
-                : "r"(a1), "r"(a2), "r"(a3), "r"(a7)                         \
-                : "memory");                                        \
+                : "+r"(a0), "+r"(a1), "+r"(a2), "+r"(a3), "+r"(a7)  \
+                :                                                   \
+                : "ra", "t0", "t1", "t2", "t3", "t4", "t5", "t6",   \
+                  "a4", "a5", "a6", "memory");                      \
     a0;                                                             \
 })
 
@@ -32,11 +42,20 @@ typedef enum {
 #define sys_lsdir(__a0, __a1) sys_call(LsDir, __a0, __a1, 0, 0)
 #define sys_cddir(__a0, __a1) sys_call(CdDir, __a0, __a1, 0, 0)
 #define sys_pwd(__a0) sys_call(Pwd, __a0, 0, 0, 0)
+#define sys_ps() sys_call(Ps, 0, 0, 0, 0)
 #define sys_open(__a0) sys_call(Open, __a0, 0, 0, 0)
 #define sys_close(__a0) sys_call(Close, __a0, 0, 0, 0)
 #define sys_read(__a0, __a1, __a2) sys_call(Read, __a0, __a1, __a2, 0)
-#define sys_write(__a0) sys_call(Write, __a0, 0, 0, 0)
+#define sys_write(__a0, __a1, __a2) sys_call(Write, __a0, __a1, __a2, 0)
 #define sys_exit(__a0) sys_call(Exit, __a0, 0, 0, 0)
 #define sys_exec(__a0, __a1) sys_call(Exec, __a0, __a1, 0, 0)
+#define sys_clone(__a0, __a1, __a2) sys_call(Clone, __a0, __a1, __a2, 0)
+#define sys_join(__a0, __a1) sys_call(Join, __a0, __a1, 0, 0)
+#define sys_futex_wait(__a0, __a1, __a2) sys_call(FutexWait, __a0, __a1, __a2, 0)
+#define sys_futex_wake(__a0, __a1) sys_call(FutexWake, __a0, __a1, 0, 0)
+#define sys_lockstat() sys_call(LockStat, 0, 0, 0, 0)
+#define sys_nanosleep(__a0) sys_call(Nanosleep, __a0, 0, 0, 0)
+#define sys_sched_setaffinity(__a0, __a1) sys_call(SchedSetaffinity, __a0, __a1, 0, 0)
+#define sys_sched_getaffinity(__a0) sys_call(SchedGetaffinity, __a0, 0, 0, 0)
 
 #endif
\ No newline at end of file
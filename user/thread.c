@@ -0,0 +1,60 @@
+/*
+ *  user/thread.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * thread.c 定义了 U-Mode 下创建和等待线程的函数
+ * 同一进程中的线程共享地址空间和文件描述符，各自使用独立的用户栈
+ */
+
+#include "types.h"
+#include "ulib.h"
+#include "syscall.h"
+
+/*
+ * 新线程的入口点
+ * 内核将线程函数和参数分别放在 a0 和 a1 中
+ * 线程函数返回后退出线程
+ */
+static void
+threadEntry(void (*fn)(void *), void *arg)
+{
+    fn(arg);
+    sys_exit(0);
+}
+
+/* 创建一个运行 fn(arg) 的线程，返回线程的 tid，失败时返回 -1 */
+int
+thread_create(void (*fn)(void *), void *arg)
+{
+    return sys_clone(threadEntry, fn, arg);
+}
+
+/*
+ * 等待 tid 号线程退出，status 不为 0 时保存线程的退出码
+ * 线程已经退出时直接返回，失败时返回 -1
+ */
+int
+thread_join(int tid, uint64 *status)
+{
+    return sys_join(tid, status);
+}
+
+/*
+ * 设置 tid 号线程允许运行的 hart 掩码，tid 为 -1 表示当前线程
+ * 只能设置同一进程中的线程，失败时返回 -1
+ */
+int
+sched_setaffinity(int tid, uint64 mask)
+{
+    return sys_sched_setaffinity(tid, mask);
+}
+
+/* 获取 tid 号线程允许运行的 hart 掩码，失败时返回 0 */
+uint64
+sched_getaffinity(int tid)
+{
+    return sys_sched_getaffinity(tid);
+}
@@ -0,0 +1,35 @@
+/*
+ *  user/time.c
+ *  
+ *  (C) 2021  Ziyang Guo
+ */
+
+/*
+ * time.c 定义了 U-Mode 下的休眠函数
+ * 线程在内核中阻塞到指定时刻，期间不占用 CPU
+ */
+
+#include "types.h"
+#include "ulib.h"
+#include "syscall.h"
+
+/* 休眠 req 指定的时长，成功返回 0 */
+int
+nanosleep(TimeSpec *req)
+{
+    return sys_nanosleep(req);
+}
+
+int
+sleep(uint64 seconds)
+{
+    TimeSpec req = {seconds, 0};
+    return nanosleep(&req);
+}
+
+int
+usleep(uint64 us)
+{
+    TimeSpec req = {us / 1000000, (us % 1000000) * 1000};
+    return nanosleep(&req);
+}
@@ -3,9 +3,11 @@
 
 /*  io.c    */
 uint8 getc();
+int read(int fd, void *buf, uint64 len);
 void printf(char *, ...);
 void panic(char*);
 void putchar(int c);
+int write(int fd, void *buf, uint64 len);
 
 /*  malloc.c    */
 void *malloc(uint32 size);
@@ -15,4 +17,35 @@ void free(void *ptr);
 int strcmp(char *str1, char *str2);
 int strlen(char *str);
 
+/*  lock.c  */
+typedef struct {
+    uint32 state;
+} Mutex;
+
+typedef struct {
+    uint32 seq;
+} Cond;
+
+void mutex_lock(Mutex *m);
+void mutex_unlock(Mutex *m);
+void cond_wait(Cond *c, Mutex *m);
+void cond_signal(Cond *c);
+void cond_broadcast(Cond *c);
+
+/*  thread.c    */
+int thread_create(void (*fn)(void *), void *arg);
+int thread_join(int tid, uint64 *status);
+int sched_setaffinity(int tid, uint64 mask);
+uint64 sched_getaffinity(int tid);
+
+/*  time.c  */
+typedef struct {
+    uint64 sec;
+    uint64 nsec;
+} TimeSpec;
+
+int nanosleep(TimeSpec *req);
+int sleep(uint64 seconds);
+int usleep(uint64 us);
+
 #endif
\ No newline at end of file